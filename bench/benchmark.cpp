@@ -0,0 +1,603 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+/* Headless throughput benchmark: a stub libretro frontend driving the core
+ * for a fixed number of frames, with no-op video and audio callbacks.
+ *
+ *   reminiscence_bench [-n frames] [-demo 1..3 | -level 1..7 [-skill 0..2]
+ *                      [-seed n]] [-input file] [-turbo batch]
+ *                      [-record file | -verify file] datadir
+ *   reminiscence_bench -batch file [-j threads] datadir
+ *   reminiscence_bench -unpack
+ *
+ * -demo replays one of the built-in demo recordings, -level starts a level
+ * (skill 1, seed 0 by default) instead of the intro, -input replays a file
+ * of little-endian 16-bit joypad masks (one per frame, RETRO_DEVICE_ID_JOYPAD
+ * bit order). -turbo drives Game::runFrames() in batches instead of
+ * retro_run(). -record writes the run to a replay file, -verify plays one
+ * back from its own snapshots and rates to its end and checks its state
+ * hashes, the exit status is 2 if they differ. Stage timings come from the
+ * core's frame profiler.
+ *
+ * -batch runs the jobs listed in file on a BatchRunner, one per line as
+ * "level skill seed inputs [frames]" (level 1..7, skill 0..2, inputs a file
+ * of little-endian 16-bit replay input masks or '-' for none), and prints
+ * each one's score, death frame, room and state hash.
+ *
+ * -unpack checks delphine_unpack() against the original bit-at-a-time
+ * decoder on random streams, output bytes around the buffer and CRC result
+ * included, then times both; the exit status is 2 if they differ. */
+
+#include <chrono>
+#include <stdarg.h>
+#include <stdio.h>
+#include "batch_runner.h"
+#include "file.h"
+#include "game.h"
+#include "palconv.h"
+#include "unpack.h"
+
+extern Game *retro_core_game(void);
+
+static int      _frames = 3000;
+static char     _profilerValue[16];
+static uint16_t *_inputs;
+static int      _inputsCount;
+static int      _inputPos;
+
+static retro_time_t RETRO_CALLCONV getTimeUsec(void) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void RETRO_CALLCONV logPrintf(enum retro_log_level level, const char *fmt, ...) {
+	if (level < RETRO_LOG_INFO) {
+		return;
+	}
+	va_list va;
+	va_start(va, fmt);
+	vfprintf(stderr, fmt, va);
+	va_end(va);
+}
+
+static bool RETRO_CALLCONV environment(unsigned cmd, void *data) {
+	switch (cmd) {
+	case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+		((struct retro_log_callback *) data)->log = logPrintf;
+		return true;
+	case RETRO_ENVIRONMENT_GET_PERF_INTERFACE: {
+			struct retro_perf_callback *perf = (struct retro_perf_callback *) data;
+			memset(perf, 0, sizeof(*perf));
+			perf->get_time_usec = getTimeUsec;
+		}
+		return true;
+	case RETRO_ENVIRONMENT_GET_VARIABLE: {
+			struct retro_variable *var = (struct retro_variable *) data;
+			if (strcmp(var->key, "reminiscence_profiler") == 0) {
+				/* a single report, on the last frame */
+				var->value = _profilerValue;
+				return true;
+			}
+		}
+		return false;
+	case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+		*(bool *) data = false;
+		return true;
+	case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+		*(bool *) data = true;
+		return true;
+	case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+	case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS:
+	case RETRO_ENVIRONMENT_SET_VARIABLES:
+	case RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL:
+		return true;
+	}
+	return false;
+}
+
+static void RETRO_CALLCONV videoRefresh(const void *data, unsigned width, unsigned height, size_t pitch) {
+}
+
+static void RETRO_CALLCONV audioSample(int16_t left, int16_t right) {
+}
+
+static size_t RETRO_CALLCONV audioSampleBatch(const int16_t *data, size_t frames) {
+	return frames;
+}
+
+static void RETRO_CALLCONV inputPoll(void) {
+	++_inputPos;
+}
+
+static int16_t RETRO_CALLCONV inputState(unsigned port, unsigned device, unsigned index, unsigned id) {
+	if (port != 0 || device != RETRO_DEVICE_JOYPAD || _inputPos > _inputsCount) {
+		return 0;
+	}
+	const uint16_t mask = _inputs[_inputPos - 1];
+	return (mask >> id) & 1;
+}
+
+static bool loadInputs(const char *path) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		return false;
+	}
+	fseek(fp, 0, SEEK_END);
+	const long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	_inputsCount = size / 2;
+	_inputs = (uint16_t *) calloc(_inputsCount + 1, sizeof(uint16_t));
+	for (int i = 0; i < _inputsCount; ++i) {
+		uint8_t buf[2];
+		if (fread(buf, 1, 2, fp) != 2) {
+			_inputsCount = i;
+			break;
+		}
+		_inputs[i] = buf[0] | (buf[1] << 8);
+	}
+	fclose(fp);
+	return true;
+}
+
+static uint8_t *loadFile(const char *path, uint32_t *size) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		return 0;
+	}
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	uint8_t *buf = (uint8_t *) malloc(*size);
+	if (buf && fread(buf, 1, *size, fp) != *size) {
+		free(buf);
+		buf = 0;
+	}
+	fclose(fp);
+	return buf;
+}
+
+static int runBatch(Game *game, const char *path, int threads) {
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Unable to read '%s'\n", path);
+		return 1;
+	}
+	BatchJob *jobs = 0;
+	int count = 0;
+	char line[1024];
+	while (fgets(line, sizeof(line), fp)) {
+		int level, skill;
+		unsigned seed, frames = 0;
+		char inputs[768];
+		if (line[0] == '#' || sscanf(line, "%d %d %u %767s %u", &level, &skill, &seed, inputs, &frames) < 4) {
+			continue;
+		}
+		BatchJob *tmp = (BatchJob *) realloc(jobs, (count + 1) * sizeof(BatchJob));
+		if (!tmp) {
+			break;
+		}
+		jobs = tmp;
+		BatchJob *job = &jobs[count++];
+		memset(job, 0, sizeof(BatchJob));
+		job->level = level - 1;
+		job->skill = skill;
+		job->seed = seed;
+		job->maxFrames = frames;
+		if (strcmp(inputs, "-") != 0) {
+			uint32_t size = 0;
+			uint8_t *buf = loadFile(inputs, &size);
+			if (!buf) {
+				fprintf(stderr, "Unable to read '%s'\n", inputs);
+			} else {
+				/* converted in place */
+				uint16_t *masks = (uint16_t *) buf;
+				for (uint32_t i = 0; i < size / 2; ++i) {
+					masks[i] = READ_LE_UINT16(buf + i * 2);
+				}
+				job->inputs = masks;
+				job->inputsCount = size / 2;
+			}
+		}
+	}
+	fclose(fp);
+
+	BatchResult *results = (BatchResult *) calloc(count + 1, sizeof(BatchResult));
+	BatchRunner runner(game->_fs, game->_res._lang);
+	const retro_time_t start = getTimeUsec();
+	const int steals = runner.run(jobs, results, count, threads);
+	const retro_time_t elapsed = getTimeUsec() - start;
+	uint64_t frames = 0;
+	for (int i = 0; i < count; ++i) {
+		const BatchResult *r = &results[i];
+		if (!r->started) {
+			fprintf(stdout, "job %d: not started\n", i + 1);
+			continue;
+		}
+		fprintf(stdout, "job %d: %u frames, death %d, level %d room %d, score %u, hash %08X\n",
+			i + 1, r->frames, r->deathFrame, r->level + 1, r->room, r->score, r->stateHash);
+		frames += r->frames;
+	}
+	fprintf(stdout, "%d jobs, %llu frames in %.3f sec, %.1f frames/sec, %d steals\n", count,
+		(unsigned long long) frames, elapsed / 1000000., frames * 1000000. / elapsed, steals);
+	for (int i = 0; i < count; ++i) {
+		free((void *) jobs[i].inputs);
+	}
+	free(jobs);
+	free(results);
+	return 0;
+}
+
+/* The original decoder, reading one bit at a time, as the reference */
+struct RefUnpackCtx {
+	int size, datasize;
+	uint32_t crc;
+	uint32_t bits;
+	uint8_t *dst;
+	const uint8_t *src;
+};
+
+static int refShiftBit(RefUnpackCtx *uc, int CF) {
+	int rCF = (uc->bits & 1);
+	uc->bits >>= 1;
+	if (CF) {
+		uc->bits |= 0x80000000;
+	}
+	return rCF;
+}
+
+static int refNextBit(RefUnpackCtx *uc) {
+	int CF = refShiftBit(uc, 0);
+	if (uc->bits == 0) {
+		uc->bits = READ_BE_UINT32(uc->src); uc->src -= 4;
+		uc->crc ^= uc->bits;
+		CF = refShiftBit(uc, 1);
+	}
+	return CF;
+}
+
+static uint16_t refGetBits(RefUnpackCtx *uc, uint8_t num_bits) {
+	uint16_t c = 0;
+	while (num_bits--) {
+		c <<= 1;
+		if (refNextBit(uc)) {
+			c |= 1;
+		}
+	}
+	return c;
+}
+
+static void refUnpackHelper1(RefUnpackCtx *uc, uint8_t num_bits, uint8_t add_count) {
+	uint16_t count = refGetBits(uc, num_bits) + add_count + 1;
+	uc->datasize -= count;
+	while (count--) {
+		*uc->dst = (uint8_t)refGetBits(uc, 8);
+		--uc->dst;
+	}
+}
+
+static void refUnpackHelper2(RefUnpackCtx *uc, uint8_t num_bits) {
+	uint16_t i = refGetBits(uc, num_bits);
+	uint16_t count = uc->size + 1;
+	uc->datasize -= count;
+	while (count--) {
+		*uc->dst = *(uc->dst + i);
+		--uc->dst;
+	}
+}
+
+static bool refUnpack(uint8_t *dst, const uint8_t *src, int len, uint32_t *crc = 0) {
+	RefUnpackCtx uc;
+	uc.src = src + len - 4;
+	uc.datasize = READ_BE_UINT32(uc.src); uc.src -= 4;
+	uc.dst = dst + uc.datasize - 1;
+	uc.size = 0;
+	uc.crc = READ_BE_UINT32(uc.src); uc.src -= 4;
+	uc.bits = READ_BE_UINT32(uc.src); uc.src -= 4;
+	uc.crc ^= uc.bits;
+	do {
+		if (!refNextBit(&uc)) {
+			uc.size = 1;
+			if (!refNextBit(&uc)) {
+				refUnpackHelper1(&uc, 3, 0);
+			} else {
+				refUnpackHelper2(&uc, 8);
+			}
+		} else {
+			uint16_t c = refGetBits(&uc, 2);
+			if (c == 3) {
+				refUnpackHelper1(&uc, 8, 8);
+			} else if (c < 2) {
+				uc.size = c + 2;
+				refUnpackHelper2(&uc, c + 9);
+			} else {
+				uc.size = refGetBits(&uc, 8);
+				refUnpackHelper2(&uc, 12);
+			}
+		}
+	} while (uc.datasize > 0);
+	if (crc) {
+		*crc = uc.crc;
+	}
+	return uc.crc == 0;
+}
+
+static uint32_t _randState = 0x12345678;
+
+static uint32_t nextRandom() {
+	_randState ^= _randState << 13;
+	_randState ^= _randState >> 17;
+	_randState ^= _randState << 5;
+	return _randState;
+}
+
+/* A random stream decodes to garbage of the size given in its trailer.
+ * Each output byte takes at most 23 bits of input and the last literal run
+ * can go 264 bytes over. The output is written backwards: a run writes past
+ * the start of the buffer and a copy reads up to 4095 bytes after its end,
+ * hence the margins. */
+static const int kUnpackMargin = 8192;
+
+static int makeRandomStream(uint8_t *src, int datasize) {
+	const int len = (datasize * 3 + 512) & ~3;
+	for (int i = 0; i < len - 8; ++i) {
+		src[i] = nextRandom();
+	}
+	/* a first word of any length, including none */
+	const int top = nextRandom() % 33;
+	const uint32_t first = (top == 32) ? 0 : (nextRandom() | (1u << top)) & (0xFFFFFFFFu >> (31 - top));
+	WRITE_BE_UINT32(src + len - 12, first);
+	WRITE_BE_UINT32(src + len - 8, 0);
+	WRITE_BE_UINT32(src + len - 4, datasize);
+	return len;
+}
+
+static int benchUnpackKernel() {
+	static const int kMaxSize = 65536;
+	uint8_t *src = (uint8_t *) malloc(kMaxSize * 3 + 512);
+	uint8_t *dst1 = (uint8_t *) malloc(kMaxSize + 2 * kUnpackMargin);
+	uint8_t *dst2 = (uint8_t *) malloc(kMaxSize + 2 * kUnpackMargin);
+	int failures = 0;
+	static const int kIterations = 2000;
+	for (int n = 0; n < kIterations; ++n) {
+		const int datasize = 1 + nextRandom() % ((n & 1) ? 64 : kMaxSize);
+		const int len = makeRandomStream(src, datasize);
+		/* every other stream gets the CRC that makes it check out */
+		for (int pass = 0; pass < 2; ++pass) {
+			memset(dst1, 0x55, datasize + 2 * kUnpackMargin);
+			memset(dst2, 0x55, datasize + 2 * kUnpackMargin);
+			uint32_t crc;
+			const bool ret1 = refUnpack(dst1 + kUnpackMargin, src, len, &crc);
+			const bool ret2 = delphine_unpack(dst2 + kUnpackMargin, src, len);
+			if (ret1 != ret2 || memcmp(dst1, dst2, datasize + 2 * kUnpackMargin) != 0 || (pass == 1 && !ret2)) {
+				if (failures == 0) {
+					fprintf(stdout, "unpack mismatch, stream %d of %d bytes\n", n, datasize);
+				}
+				++failures;
+				break;
+			}
+			if ((n & 2) == 0) {
+				break;
+			}
+			WRITE_BE_UINT32(src + len - 8, crc);
+		}
+	}
+	fprintf(stdout, "unpack: %d random streams, %d mismatches\n", kIterations, failures);
+
+	const int len = makeRandomStream(src, kMaxSize);
+	static const int kCount = 200;
+	retro_time_t t = getTimeUsec();
+	for (int n = 0; n < kCount; ++n) {
+		refUnpack(dst1 + kUnpackMargin, src, len);
+	}
+	const retro_time_t ref = getTimeUsec() - t;
+	t = getTimeUsec();
+	for (int n = 0; n < kCount; ++n) {
+		delphine_unpack(dst2 + kUnpackMargin, src, len);
+	}
+	const retro_time_t cur = getTimeUsec() - t;
+	fprintf(stdout, "unpack 64KB: bit reader %.1f MB/sec, reservoir %.1f MB/sec\n",
+		kMaxSize * (double) kCount / ref, kMaxSize * (double) kCount / cur);
+	free(src);
+	free(dst1);
+	free(dst2);
+	return failures;
+}
+
+static void benchPaletteKernel() {
+	static uint8_t src[Video::GAMESCREEN_SIZE];
+	static uint32_t dst[Video::GAMESCREEN_SIZE];
+	uint32_t pal[256];
+	uint16_t pal16[256];
+	static PalPlanes planes;
+	for (int i = 0; i < Video::GAMESCREEN_SIZE; ++i) {
+		src[i] = (i * 7 + (i >> 8)) & 255;
+	}
+	for (int i = 0; i < 256; ++i) {
+		pal[i] = i * 0x010101;
+		pal16[i] = ((i & 0xF8) << 8) | ((i & 0xFC) << 3) | (i >> 3);
+	}
+	palSplit(&planes, pal, pal16);
+	static const int kCount = 1000;
+	retro_time_t t = getTimeUsec();
+	for (int n = 0; n < kCount; ++n) {
+		for (int i = 0; i < Video::GAMESCREEN_SIZE; ++i) {
+			dst[i] = pal[src[i]];
+		}
+		__asm__ volatile("" : : "r"(dst) : "memory");
+	}
+	const retro_time_t loop = getTimeUsec() - t;
+	palExpandInit();
+	t = getTimeUsec();
+	for (int n = 0; n < kCount; ++n) {
+		palExpand32(dst, src, Video::GAMESCREEN_SIZE, pal, &planes);
+		__asm__ volatile("" : : "r"(dst) : "memory");
+	}
+	const retro_time_t kernel = getTimeUsec() - t;
+	for (int i = 0; i < Video::GAMESCREEN_SIZE; ++i) {
+		if (dst[i] != pal[src[i]]) {
+			fprintf(stderr, "palette expansion mismatch at pixel %d\n", i);
+			break;
+		}
+	}
+	t = getTimeUsec();
+	for (int n = 0; n < kCount; ++n) {
+		palExpand16((uint16_t *)dst, src, Video::GAMESCREEN_SIZE, pal16, &planes);
+		__asm__ volatile("" : : "r"(dst) : "memory");
+	}
+	const retro_time_t kernel16 = getTimeUsec() - t;
+	fprintf(stdout, "palette expansion 256x224: loop %.1f usec, %s %.1f usec, rgb565 %.1f usec\n",
+		loop / (double) kCount, palExpandName(), kernel / (double) kCount, kernel16 / (double) kCount);
+}
+
+int main(int argc, char *argv[]) {
+	int demo = 0;
+	int level = 0;
+	int skill = 1;
+	uint32_t seed = 0;
+	int turbo = 0;
+	const char *inputPath = 0;
+	const char *recordPath = 0;
+	const char *verifyPath = 0;
+	const char *batchPath = 0;
+	int threads = 0;
+	bool unpack = false;
+	const char *dataPath = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			_frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-demo") == 0 && i + 1 < argc) {
+			demo = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-level") == 0 && i + 1 < argc) {
+			level = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-skill") == 0 && i + 1 < argc) {
+			skill = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+			seed = strtoul(argv[++i], 0, 0);
+		} else if (strcmp(argv[i], "-input") == 0 && i + 1 < argc) {
+			inputPath = argv[++i];
+		} else if (strcmp(argv[i], "-turbo") == 0 && i + 1 < argc) {
+			turbo = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+			recordPath = argv[++i];
+		} else if (strcmp(argv[i], "-verify") == 0 && i + 1 < argc) {
+			verifyPath = argv[++i];
+		} else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc) {
+			batchPath = argv[++i];
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-unpack") == 0) {
+			unpack = true;
+		} else if (argv[i][0] != '-') {
+			dataPath = argv[i];
+		}
+	}
+	if (unpack) {
+		return benchUnpackKernel() == 0 ? 0 : 2;
+	}
+	if (!dataPath || _frames <= 0) {
+		fprintf(stderr, "Usage: %s [-n frames] [-demo 1..3 | -level 1..7 [-skill 0..2] [-seed n]] [-input file] [-turbo batch]\n"
+			"       [-record file | -verify file] datadir\n"
+			"       %s -batch file [-j threads] datadir\n"
+			"       %s -unpack\n", argv[0], argv[0], argv[0]);
+		return 1;
+	}
+	if (inputPath && !loadInputs(inputPath)) {
+		fprintf(stderr, "Unable to read '%s'\n", inputPath);
+		return 1;
+	}
+	snprintf(_profilerValue, sizeof(_profilerValue), "%d", _frames);
+
+	benchPaletteKernel();
+
+	retro_set_environment(environment);
+	retro_set_video_refresh(videoRefresh);
+	retro_set_audio_sample(audioSample);
+	retro_set_audio_sample_batch(audioSampleBatch);
+	retro_set_input_poll(inputPoll);
+	retro_set_input_state(inputState);
+	retro_init();
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/LEVEL1.MAP", dataPath);
+	struct retro_game_info info;
+	memset(&info, 0, sizeof(info));
+	info.path = path;
+	if (!retro_load_game(&info)) {
+		fprintf(stderr, "Unable to load game data from '%s'\n", dataPath);
+		retro_deinit();
+		return 1;
+	}
+	Game *game = retro_core_game();
+	if (batchPath) {
+		const int ret = runBatch(game, batchPath, threads);
+		retro_unload_game();
+		retro_deinit();
+		return ret;
+	}
+	if (demo != 0 && !game->startDemo(demo - 1)) {
+		fprintf(stderr, "Unable to start demo %d\n", demo);
+	} else if (level != 0 && !game->startLevel(level - 1, skill, seed)) {
+		fprintf(stderr, "Unable to start level %d\n", level);
+	}
+	if (recordPath) {
+		game->startRecording();
+	}
+	if (verifyPath) {
+		uint32_t size = 0;
+		uint8_t *replay = loadFile(verifyPath, &size);
+		File f;
+		f.open(new ReadOnlyMemFile(replay, size));
+		if (!replay || !game->startReplay(&f)) {
+			fprintf(stderr, "Unable to start replay '%s'\n", verifyPath);
+			free(replay);
+			retro_unload_game();
+			retro_deinit();
+			return 1;
+		}
+		free(replay);
+		_frames = 0x7FFFFFFF;
+	}
+
+	const retro_time_t start = getTimeUsec();
+	int count = 0;
+	if (turbo > 0) {
+		/* turbo bypasses retro_run(), so no input callbacks either */
+		while (count < _frames && game->isRunning() && (!verifyPath || game->isReplaying())) {
+			const int n = (_frames - count < turbo) ? _frames - count : turbo;
+			count += game->runFrames(n);
+		}
+	} else {
+		for (; count < _frames && game->isRunning() && (!verifyPath || game->isReplaying()); ++count) {
+			retro_run();
+		}
+	}
+	const retro_time_t elapsed = getTimeUsec() - start;
+	fprintf(stdout, "%d frames in %.3f sec, %.1f frames/sec (%.1fx realtime)\n", count, elapsed / 1000000.,
+		count * 1000000. / elapsed, count * 1000000. / elapsed / game->getFrameRate());
+
+	int ret = 0;
+	if (recordPath) {
+		MemFile *mf = new MemFile;
+		File f;
+		f.open(mf);
+		FILE *fp = fopen(recordPath, "wb");
+		if (!game->stopRecording(&f) || !fp || fwrite(mf->_mem, 1, mf->_size, fp) != mf->_size) {
+			fprintf(stderr, "Unable to write replay '%s'\n", recordPath);
+			ret = 1;
+		}
+		if (fp) {
+			fclose(fp);
+		}
+		free(mf->_mem);
+	}
+	if (verifyPath && (game->isReplaying() || game->getReplayMismatches() != 0)) {
+		fprintf(stdout, "replay '%s' does not match\n", verifyPath);
+		ret = 2;
+	}
+
+	retro_unload_game();
+	retro_deinit();
+	free(_inputs);
+	return ret;
+}
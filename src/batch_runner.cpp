@@ -0,0 +1,167 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifdef HAVE_STD_THREADS
+#include <thread>
+#endif
+#include "batch_runner.h"
+#include "game.h"
+
+BatchRunner::BatchRunner(FileSystem *fs, Language lang)
+	: _fs(fs), _lang(lang), _jobs(0), _results(0), _ranges(0), _threads(0) {
+}
+
+int BatchRunner::run(const BatchJob *jobs, BatchResult *results, int count, int threads) {
+#ifdef HAVE_STD_THREADS
+	if (threads <= 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+#else
+	threads = 1;
+#endif
+	if (threads > count) {
+		threads = count;
+	}
+	if (threads <= 0) {
+		return 0;
+	}
+	_jobs = jobs;
+	_results = results;
+	_threads = threads;
+	_ranges = new Range[threads];
+	for (int i = 0; i < threads; ++i) {
+		_ranges[i].head = (int)((int64_t)count * i / threads);
+		_ranges[i].tail = (int)((int64_t)count * (i + 1) / threads);
+		_ranges[i].steals = 0;
+	}
+#ifdef HAVE_STD_THREADS
+	std::thread *pool = new std::thread[threads - 1];
+	for (int i = 1; i < threads; ++i) {
+		pool[i - 1] = std::thread(&BatchRunner::runThread, this, i);
+	}
+	runThread(0);
+	for (int i = 1; i < threads; ++i) {
+		pool[i - 1].join();
+	}
+	delete[] pool;
+#else
+	runThread(0);
+#endif
+	int steals = 0;
+	for (int i = 0; i < threads; ++i) {
+		steals += _ranges[i].steals;
+	}
+	delete[] _ranges;
+	_ranges = 0;
+	return steals;
+}
+
+void BatchRunner::runJob(const BatchJob *job, BatchResult *result) {
+	memset(result, 0, sizeof(BatchResult));
+	result->deathFrame = -1;
+	/* no save path, the checkpoints are not written */
+	Game *g = new Game(_fs, 0, 0, _lang);
+	/* the threads are all busy with jobs already */
+	g->_prefetch.setEnabled(false, &g->_res);
+	g->init();
+	if (!g->startLevel(job->level, job->skill, job->seed)) {
+		log_cb(RETRO_LOG_WARN, "[RE]: Unable to start level %d skill %d\n", job->level, job->skill);
+		delete g;
+		return;
+	}
+	result->started = true;
+	/* no present is converted, the framebuffer is never read */
+	g->_vid._skipPresent = true;
+	const uint32_t frames = job->maxFrames ? job->maxFrames : job->inputsCount;
+	uint32_t frame = 0;
+	while (frame < frames && g->isRunning()) {
+		g->setInputMask(frame < job->inputsCount ? job->inputs[frame] : 0);
+		g->runFrame();
+		g->_mix.skip(g->getFrameSamples());
+		++frame;
+		if (g->_deathCutsceneCounter != 0) {
+			result->deathFrame = frame - 1;
+			break;
+		}
+	}
+	result->frames = frame;
+	result->score = g->_score;
+	result->level = g->_currentLevel;
+	result->room = g->_currentRoom;
+	result->stateHash = g->getStateHash();
+	delete g;
+}
+
+void BatchRunner::runThread(int num) {
+	int job;
+	while (nextJob(num, &job)) {
+		runJob(&_jobs[job], &_results[job]);
+	}
+}
+
+bool BatchRunner::nextJob(int num, int *job) {
+	Range *r = &_ranges[num];
+	for (;;) {
+		{
+#ifdef HAVE_STD_THREADS
+			std::lock_guard<std::mutex> lock(r->mutex);
+#endif
+			if (r->head < r->tail) {
+				*job = r->head++;
+				return true;
+			}
+		}
+		if (!steal(num)) {
+			return false;
+		}
+	}
+}
+
+/* Takes the second half of the largest range left, rounded up so that a
+ * last job is taken as well; its owner keeps working from the head. */
+bool BatchRunner::steal(int num) {
+	for (;;) {
+		int victim = -1;
+		int size = 0;
+		for (int i = 0; i < _threads; ++i) {
+			if (i == num) {
+				continue;
+			}
+#ifdef HAVE_STD_THREADS
+			std::lock_guard<std::mutex> lock(_ranges[i].mutex);
+#endif
+			const int n = _ranges[i].tail - _ranges[i].head;
+			if (n > size) {
+				size = n;
+				victim = i;
+			}
+		}
+		if (victim < 0) {
+			return false;
+		}
+		int head, tail;
+		{
+			Range *v = &_ranges[victim];
+#ifdef HAVE_STD_THREADS
+			std::lock_guard<std::mutex> lock(v->mutex);
+#endif
+			const int n = v->tail - v->head;
+			if (n <= 0) {
+				continue; /* drained meanwhile, look again */
+			}
+			tail = v->tail;
+			head = v->tail - (n + 1) / 2;
+			v->tail = head;
+		}
+		Range *r = &_ranges[num];
+#ifdef HAVE_STD_THREADS
+		std::lock_guard<std::mutex> lock(r->mutex);
+#endif
+		r->head = head;
+		r->tail = tail;
+		++r->steals;
+		return true;
+	}
+}
@@ -0,0 +1,73 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef BATCH_RUNNER_H__
+#define BATCH_RUNNER_H__
+
+#include "intern.h"
+#ifdef HAVE_STD_THREADS
+#include <mutex>
+#endif
+
+struct FileSystem;
+struct Game;
+
+/* A headless run: level started at skill with seed, then one replay input
+ * mask (see Game::setInputMask) per frame. The run ends when the player
+ * dies, the game ends or maxFrames is reached; inputs stop at inputsCount
+ * frames, released after that. maxFrames 0 runs as long as the inputs. */
+struct BatchJob {
+	int            level;
+	int            skill;
+	uint32_t       seed;
+	const uint16_t *inputs;
+	uint32_t       inputsCount;
+	uint32_t       maxFrames;
+};
+
+struct BatchResult {
+	bool     started;
+	uint32_t frames;
+	int32_t  deathFrame; /* -1 if the player is still alive */
+	uint32_t score;
+	uint8_t  level;
+	uint8_t  room;
+	uint32_t stateHash;
+};
+
+/* Runs jobs on a pool of threads, a Game instance per job, with no video
+ * conversion nor audio mixing. Each thread starts with a contiguous range
+ * of the jobs and, once it is done with it, steals the second half of the
+ * largest range left, so that runs of uneven length keep every thread
+ * busy. Without HAVE_STD_THREADS the jobs run one after the other. The
+ * FileSystem is only read and shared by all the instances. */
+struct BatchRunner {
+	struct Range {
+#ifdef HAVE_STD_THREADS
+		std::mutex mutex;
+#endif
+		int        head;
+		int        tail;
+		int        steals;
+	};
+
+	FileSystem        *_fs;
+	Language          _lang;
+	const BatchJob    *_jobs;
+	BatchResult       *_results;
+	Range             *_ranges;
+	int               _threads;
+
+	BatchRunner(FileSystem *fs, Language lang);
+
+	/* threads 0 uses one per core, returns the number of steals */
+	int run(const BatchJob *jobs, BatchResult *results, int count, int threads);
+	void runJob(const BatchJob *job, BatchResult *result);
+	void runThread(int num);
+	bool nextJob(int num, int *job);
+	bool steal(int num);
+};
+
+#endif // BATCH_RUNNER_H__
@@ -12,6 +12,12 @@
 Cutscene::Cutscene(Resource *res, Game *game, Video *vid)
 	: _res(res), _game(game), _vid(vid) {
 	_patchedOffsetsTable = 0;
+	_cutName = 0xFFFF;
+	_polPtr = _cmdPtr = _cmdPtrBak = 0;
+	_textCurPtr = 0;
+	_textCurBuf = 0;
+	_page0 = _page1 = _pageC = 0;
+	_credSeqPtr = 0;
 	memset(_palBuf, 0, sizeof(_palBuf));
 }
 
@@ -1198,7 +1204,7 @@ bool Cutscene::playSetup() {
 	prepare();
 	uint16_t cutName = _offsetsTable[_id * 2 + 0];
 	uint16_t cutOff  = _offsetsTable[_id * 2 + 1];
-	if (cutName == 0xFFFF && g_options.play_disabled_cutscenes) {
+	if (cutName == 0xFFFF && _game->_options.play_disabled_cutscenes) {
 		switch (_id) {
 		case 19:
 			cutName = 31;
@@ -1279,12 +1285,15 @@ void Cutscene::load(uint16_t cutName) {
 	_res->load(name, Resource::OT_CMD);
 	_res->load(name, Resource::OT_POL);
 	_res->load_CINE();
+	_cutName = cutName;
 }
 
 void Cutscene::prepare() {
 	_page0 = _vid->_frontLayer;
 	_page1 = _vid->_tempLayer;
 	_pageC = _vid->_tempLayer2;
+	/* the pages are drawn without dirty tracking */
+	_vid->invalidateFrontLayer();
 	_game->_pi.dirMask = 0;
 	_game->_pi.use = false;
 	_game->_pi.weapon = false;
@@ -1333,7 +1342,7 @@ bool Cutscene::playTextStep() {
 		return false;
 	}
 	{
-		const int mpf = 1000 / _game->getFrameRate();
+		const int mpf = _game->_frameMs;
 		while ((int)_game->_paceAccumMs < mpf) {
 			_game->_paceAccumMs += TIMER_SLICE;
 		}
@@ -1375,7 +1384,7 @@ void Cutscene::play() {
 		prepare();
 		uint16_t cutName = _offsetsTable[_id * 2 + 0];
 		uint16_t cutOff  = _offsetsTable[_id * 2 + 1];
-		if (cutName == 0xFFFF && g_options.play_disabled_cutscenes) {
+		if (cutName == 0xFFFF && _game->_options.play_disabled_cutscenes) {
 			switch (_id) {
 			case 19:
 				cutName = 31; // SERRURE
@@ -1400,7 +1409,7 @@ void Cutscene::play() {
 				}
 			}
 		}
-		if (g_options.use_text_cutscenes) {
+		if (_game->_options.use_text_cutscenes) {
 			const Text *textsTable = (_res->_lang == LANG_FR) ? _frTextsTable : _enTextsTable;
 			for (int i = 0; textsTable[i].str; ++i) {
 				if (_id == textsTable[i].num) {
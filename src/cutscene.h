@@ -19,6 +19,7 @@ struct Cutscene {
 
 	enum {
 		NUM_OPCODES = 15,
+		NUM_NAMES   = 35, /* _namesTable */
 		TIMER_SLICE = 15
 	};
 
@@ -34,7 +35,9 @@ struct Cutscene {
 	static const uint16_t _cosTable[];
 	static const uint16_t _sinTable[];
 	static const uint8_t _creditsDataDOS[];
+	static const int _creditsDataDOSSize;
 	static const uint16_t _creditsCutSeq[];
+	static const int _creditsCutSeqCount;
 	static const uint8_t _musicTable[];
 	static const Text _frTextsTable[];
 	static const Text _enTextsTable[];
@@ -44,6 +47,7 @@ struct Cutscene {
 	Game *_game;
 	Video *_vid;
 	const uint8_t *_patchedOffsetsTable;
+	uint16_t _cutName; /* _namesTable index of the loaded CMD/POL, 0xFFFF if none */
 
 	uint16_t _id;
 	uint16_t _deathCutsceneId;
@@ -7,6 +7,12 @@
 #include <retro_miscellaneous.h>
 
 #include <streams/file_stream.h>
+#ifdef HAVE_FILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "file.h"
 #include "fs.h"
@@ -74,6 +80,53 @@ struct StdioFile : File_impl {
 	}
 };
 
+#ifdef HAVE_FILE_MMAP
+/* Read-only file mapped in memory. The mapping is private and writable, so
+ * that loaders can patch their data in place, the pages are copied on the
+ * first write. Reading past the end sets the error flag, like the other
+ * files. */
+struct MmapFile : ReadOnlyMemFile {
+	MmapFile() : ReadOnlyMemFile(0, 0) {}
+
+	bool open(const char *path, const char *mode)
+	{
+		_ioErr = false;
+		const int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		void *p = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= 0x7FFFFFFF)
+			p = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		_mem  = (const uint8_t *)p;
+		_size = st.st_size;
+		_pos  = 0;
+		return true;
+	}
+
+	void close()
+	{
+		if (_mem)
+		{
+			munmap((void *)_mem, _size);
+			_mem = 0;
+		}
+	}
+
+	uint8_t *detachMapping()
+	{
+		uint8_t *p = (uint8_t *)_mem;
+		_mem = 0;
+		return p;
+	}
+};
+#endif
+
+bool File::_mappingEnabled = true;
+
 File::File()
 	: _impl(0) {
 }
@@ -88,12 +141,20 @@ File::~File() {
 bool File::open(const char *filename, const char *mode, FileSystem *fs) {
 	cleanup();
 	assert(mode[0] != 'z');
+	const char *path = fs->findPath(filename);
+#ifdef HAVE_FILE_MMAP
+	if (path && strchr(mode, 'm') && _mappingEnabled) {
+		_impl = new MmapFile;
+		if (_impl->open(path, mode)) {
+			return true;
+		}
+		/* empty, or not a plain file */
+		delete _impl;
+	}
+#endif
 	_impl = new StdioFile;
-	char *path = fs->findPath(filename);
 	if (path) {
-		bool ret = _impl->open(path, mode);
-		free(path);
-		return ret;
+		return _impl->open(path, mode);
 	}
 	return false;
 }
@@ -151,6 +212,18 @@ uint32_t File::read(void *ptr, uint32_t len) {
 	return _impl->read(ptr, len);
 }
 
+uint8_t *File::detachMapping() {
+	return _impl->detachMapping();
+}
+
+void File::unmap(uint8_t *p, uint32_t size) {
+#ifdef HAVE_FILE_MMAP
+	if (p) {
+		munmap(p, size);
+	}
+#endif
+}
+
 uint8_t File::readByte() {
 	uint8_t b;
 	read(&b, 1);
@@ -158,27 +231,27 @@ uint8_t File::readByte() {
 }
 
 uint16_t File::readUint16LE() {
-	uint8_t lo = readByte();
-	uint8_t hi = readByte();
-	return (hi << 8) | lo;
+	uint16_t n;
+	readUint16LE(&n, 1);
+	return n;
 }
 
 uint32_t File::readUint32LE() {
-	uint16_t lo = readUint16LE();
-	uint16_t hi = readUint16LE();
-	return (hi << 16) | lo;
+	uint32_t n;
+	readUint32LE(&n, 1);
+	return n;
 }
 
 uint16_t File::readUint16BE() {
-	uint8_t hi = readByte();
-	uint8_t lo = readByte();
-	return (hi << 8) | lo;
+	uint16_t n;
+	readUint16BE(&n, 1);
+	return n;
 }
 
 uint32_t File::readUint32BE() {
-	uint16_t hi = readUint16BE();
-	uint16_t lo = readUint16BE();
-	return (hi << 16) | lo;
+	uint32_t n;
+	readUint32BE(&n, 1);
+	return n;
 }
 
 uint32_t File::write(const void *ptr, uint32_t len) {
@@ -190,13 +263,115 @@ void File::writeByte(uint8_t b) {
 }
 
 void File::writeUint16BE(uint16_t n) {
-	writeByte(n >> 8);
-	writeByte(n & 0xFF);
+	writeUint16BE(&n, 1);
 }
 
 void File::writeUint32BE(uint32_t n) {
-	writeUint16BE(n >> 16);
-	writeUint16BE(n & 0xFFFF);
+	writeUint32BE(&n, 1);
+}
+
+/* values per block when the file is not in memory */
+static const uint32_t kBulkBlockSize = 256;
+
+static void decodeUint16LE(uint16_t *dst, const uint8_t *p, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, p += 2) {
+		dst[i] = p[0] | (p[1] << 8);
+	}
+}
+
+static void decodeUint32LE(uint32_t *dst, const uint8_t *p, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, p += 4) {
+		dst[i] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+}
+
+static void decodeUint16BE(uint16_t *dst, const uint8_t *p, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, p += 2) {
+		dst[i] = (p[0] << 8) | p[1];
+	}
+}
+
+static void decodeUint32BE(uint32_t *dst, const uint8_t *p, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, p += 4) {
+		dst[i] = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+}
+
+static void encodeUint16BE(uint8_t *p, const uint16_t *src, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, p += 2) {
+		p[0] = src[i] >> 8;
+		p[1] = src[i] & 0xFF;
+	}
+}
+
+static void encodeUint32BE(uint8_t *p, const uint32_t *src, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, p += 4) {
+		p[0] = src[i] >> 24;
+		p[1] = (src[i] >> 16) & 0xFF;
+		p[2] = (src[i] >> 8) & 0xFF;
+		p[3] = src[i] & 0xFF;
+	}
+}
+
+/* Values short of a truncated read come back as 0. */
+template <typename T>
+static void readBulk(File *f, File_impl *impl, T *dst, uint32_t count, void (*decode)(T *, const uint8_t *, uint32_t)) {
+	const uint8_t *p = impl->readPtr(count * sizeof(T));
+	if (p) {
+		decode(dst, p, count);
+		return;
+	}
+	uint8_t buf[kBulkBlockSize * sizeof(T)];
+	while (count != 0) {
+		const uint32_t n = (count < kBulkBlockSize) ? count : kBulkBlockSize;
+		const uint32_t len = n * sizeof(T);
+		const uint32_t r = f->read(buf, len);
+		memset(buf + r, 0, len - r);
+		decode(dst, buf, n);
+		dst += n;
+		count -= n;
+	}
+}
+
+template <typename T>
+static void writeBulk(File *f, File_impl *impl, const T *src, uint32_t count, void (*encode)(uint8_t *, const T *, uint32_t)) {
+	uint8_t *p = impl->writePtr(count * sizeof(T));
+	if (p) {
+		encode(p, src, count);
+		return;
+	}
+	uint8_t buf[kBulkBlockSize * sizeof(T)];
+	while (count != 0) {
+		const uint32_t n = (count < kBulkBlockSize) ? count : kBulkBlockSize;
+		encode(buf, src, n);
+		f->write(buf, n * sizeof(T));
+		src += n;
+		count -= n;
+	}
+}
+
+void File::readUint16LE(uint16_t *dst, uint32_t count) {
+	readBulk(this, _impl, dst, count, decodeUint16LE);
+}
+
+void File::readUint32LE(uint32_t *dst, uint32_t count) {
+	readBulk(this, _impl, dst, count, decodeUint32LE);
+}
+
+void File::readUint16BE(uint16_t *dst, uint32_t count) {
+	readBulk(this, _impl, dst, count, decodeUint16BE);
+}
+
+void File::readUint32BE(uint32_t *dst, uint32_t count) {
+	readBulk(this, _impl, dst, count, decodeUint32BE);
+}
+
+void File::writeUint16BE(const uint16_t *src, uint32_t count) {
+	writeBulk(this, _impl, src, count, encodeUint16BE);
+}
+
+void File::writeUint32BE(const uint32_t *src, uint32_t count) {
+	writeBulk(this, _impl, src, count, encodeUint32BE);
 }
 
 MemFile::MemFile(uint8_t *mem, uint32_t size)
@@ -233,7 +408,7 @@ uint32_t MemFile::read(void *ptr, uint32_t len)
 		_ioErr  = true;
 	}
 
-	memcpy(ptr, reinterpret_cast<const void *>(_mem[_pos]), to_read);
+	memcpy(ptr, reinterpret_cast<const void *>(_mem + _pos), to_read);
 	_pos += to_read;
 
 	return to_read;
@@ -279,6 +454,34 @@ uint32_t MemFile::write(const void *ptr, uint32_t len)
    return to_write;
 }
 
+const uint8_t *MemFile::readPtr(uint32_t len)
+{
+	if (_ioErr || len > _size - _pos)
+		return 0;
+	const uint8_t *p = _mem + _pos;
+	_pos += len;
+	return p;
+}
+
+uint8_t *MemFile::writePtr(uint32_t len)
+{
+	if (_ioErr)
+		return 0;
+	if (len > _size - _pos)
+	{
+		if (!_canResize)
+			return 0;
+		uint8_t *tmp = static_cast<uint8_t *>(realloc(_mem, _pos + len));
+		if (!tmp)
+			return 0;
+		_mem  = tmp;
+		_size = _pos + len;
+	}
+	uint8_t *p = _mem + _pos;
+	_pos += len;
+	return p;
+}
+
 ReadOnlyMemFile::ReadOnlyMemFile(const uint8_t *mem, uint32_t size)
 	: _mem(mem), _pos(0), _size(size)
 {
@@ -326,3 +529,12 @@ uint32_t ReadOnlyMemFile::write(const void *ptr, uint32_t len)
 	_ioErr = true;
 	return 0;
 }
+
+const uint8_t *ReadOnlyMemFile::readPtr(uint32_t len)
+{
+	if (_ioErr || len > _size - _pos)
+		return 0;
+	const uint8_t *p = _mem + _pos;
+	_pos += len;
+	return p;
+}
@@ -22,6 +22,12 @@ struct File_impl {
 	virtual void seek(int32_t off) = 0;
 	virtual uint32_t read(void *ptr, uint32_t len) = 0;
 	virtual uint32_t write(const void *ptr, uint32_t len) = 0;
+	/* Direct access to the next len bytes of an in-memory file, advancing
+	 * the position; NULL if not in memory or out of bounds. */
+	virtual const uint8_t *readPtr(uint32_t len) { return 0; }
+	virtual uint8_t *writePtr(uint32_t len) { return 0; }
+	/* Hands over the mapping of a mapped file, see File::detachMapping() */
+	virtual uint8_t *detachMapping() { return 0; }
 };
 
 struct FileSystem;
@@ -32,6 +38,13 @@ struct File {
 
 	File_impl *_impl;
 
+	/* Mapping goes around the libretro VFS, so it is only done when the
+	 * frontend does not provide one (see setMapping()). */
+	static bool _mappingEnabled;
+	static void setMapping(bool enable) { _mappingEnabled = enable; }
+
+	/* An 'm' in mode maps the file in memory where supported (HAVE_FILE_MMAP)
+	 * and enabled, reading it through the libretro VFS otherwise. */
 	bool open(const char *filename, const char *mode, FileSystem *fs);
 	bool open(const char *filename, const char *mode, const char *directory);
 	bool open(File_impl *impl);
@@ -51,6 +64,20 @@ struct File {
 	void writeByte(uint8_t b);
 	void writeUint16BE(uint16_t n);
 	void writeUint32BE(uint32_t n);
+	/* Bulk accessors for count values, decoded straight from the memory of
+	 * a MemFile or ReadOnlyMemFile, or read in blocks otherwise. */
+	void readUint16LE(uint16_t *dst, uint32_t count);
+	void readUint32LE(uint32_t *dst, uint32_t count);
+	void readUint16BE(uint16_t *dst, uint32_t count);
+	void readUint32BE(uint32_t *dst, uint32_t count);
+	void writeUint16BE(const uint16_t *src, uint32_t count);
+	void writeUint32BE(const uint32_t *src, uint32_t count);
+	/* The whole contents of a mapped file, size() bytes, which stay valid
+	 * after the file is closed until given to unmap(). The pages are
+	 * private, writes to them are not seen by the file nor by other
+	 * instances. NULL if the file is not mapped. */
+	uint8_t *detachMapping();
+	static void unmap(uint8_t *p, uint32_t size);
 };
 
 struct MemFile : File_impl {
@@ -74,6 +101,10 @@ struct MemFile : File_impl {
 	uint32_t read(void *ptr, uint32_t len);
 
 	uint32_t write(const void *ptr, uint32_t len);
+
+	const uint8_t *readPtr(uint32_t len);
+
+	uint8_t *writePtr(uint32_t len);
 };
 
 struct ReadOnlyMemFile : File_impl {
@@ -94,6 +125,8 @@ struct ReadOnlyMemFile : File_impl {
 	uint32_t read(void *ptr, uint32_t len);
 
 	uint32_t write(const void *ptr, uint32_t len);
+
+	const uint8_t *readPtr(uint32_t len);
 };
 
 #endif // FILE_H__
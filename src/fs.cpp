@@ -4,6 +4,7 @@
  * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <streams/file_stream.h>  /* pulls in vfs/vfs_implementation.h (dir API) */
 #include <retro_miscellaneous.h>  /* PATH_MAX_LENGTH */
@@ -13,17 +14,33 @@ struct FileName
 {
    char *name;
    int dir;
+   char *path;
+   uint32_t hash;
 };
 
+/* case-folded, as the lookups are case insensitive */
+static uint32_t hashFileName(const char *name) {
+   uint32_t h = 2166136261u;
+   for (; *name; ++name) {
+      h = (h ^ (uint8_t)tolower((uint8_t)*name)) * 16777619;
+   }
+   return h;
+}
+
+/* The files found under the data directory, indexed by a hash table built
+ * once the tree is scanned. It holds 1-based indices into _filesList, with
+ * linear probing, and is kept at most half full. */
 struct FileSystem_impl
 {
    char **_dirsList;
    int _dirsCount;
    FileName *_filesList;
    int _filesCount;
+   int *_hashTable;
+   uint32_t _hashMask;
 
    FileSystem_impl() :
-      _dirsList(0), _dirsCount(0), _filesList(0), _filesCount(0) {
+      _dirsList(0), _dirsCount(0), _filesList(0), _filesCount(0), _hashTable(0), _hashMask(0) {
       }
 
    ~FileSystem_impl() {
@@ -33,35 +50,67 @@ struct FileSystem_impl
       free(_dirsList);
       for (int i = 0; i < _filesCount; ++i) {
          free(_filesList[i].name);
+         free(_filesList[i].path);
       }
       free(_filesList);
+      free(_hashTable);
    }
 
    void setRootDirectory(const char *dir) {
       getPathListFromDirectory(dir);
+      buildIndex();
    }
 
-   int findPathIndex(const char *name) const {
+   void buildIndex() {
+      uint32_t size = 16;
+      while (size < (uint32_t)_filesCount * 2) {
+         size *= 2;
+      }
+      _hashTable = (int *)calloc(size, sizeof(int));
+      if (!_hashTable) {
+         return;
+      }
+      _hashMask = size - 1;
       for (int i = 0; i < _filesCount; ++i) {
-         if (strcasecmp(_filesList[i].name, name) == 0) {
+         FileName *fn = &_filesList[i];
+         const char *dir = _dirsList[fn->dir];
+         const int len = strlen(dir) + 1 + strlen(fn->name) + 1;
+         fn->path = (char *)malloc(len);
+         if (fn->path) {
+            snprintf(fn->path, len, "%s/%s", dir, fn->name);
+         }
+         fn->hash = hashFileName(fn->name);
+         /* the first file of a name found in the scan wins, as before */
+         uint32_t pos = fn->hash & _hashMask;
+         for (; _hashTable[pos] != 0; pos = (pos + 1) & _hashMask) {
+            const FileName *other = &_filesList[_hashTable[pos] - 1];
+            if (other->hash == fn->hash && strcasecmp(other->name, fn->name) == 0) {
+               break;
+            }
+         }
+         if (_hashTable[pos] == 0) {
+            _hashTable[pos] = i + 1;
+         }
+      }
+   }
+
+   int findPathIndex(const char *name) const {
+      if (!_hashTable) {
+         return -1;
+      }
+      const uint32_t hash = hashFileName(name);
+      for (uint32_t pos = hash & _hashMask; _hashTable[pos] != 0; pos = (pos + 1) & _hashMask) {
+         const int i = _hashTable[pos] - 1;
+         if (_filesList[i].hash == hash && strcasecmp(_filesList[i].name, name) == 0) {
             return i;
          }
       }
       return -1;
    }
 
-   char *getPath(const char *name) const {
+   const char *getPath(const char *name) const {
       const int i = findPathIndex(name);
-      if (i >= 0) {
-         const char *dir = _dirsList[_filesList[i].dir];
-         const int len = strlen(dir) + 1 + strlen(_filesList[i].name) + 1;
-         char *p = (char *)malloc(len);
-         if (p) {
-            snprintf(p, len, "%s/%s", dir, _filesList[i].name);
-         }
-         return p;
-      }
-      return 0;
+      return (i >= 0) ? _filesList[i].path : 0;
    }
 
    void addPath(const char *dir, const char *name) {
@@ -87,6 +136,8 @@ struct FileSystem_impl
             _filesList = tmp;
             _filesList[_filesCount].name = strdup(name);
             _filesList[_filesCount].dir = index;
+            _filesList[_filesCount].path = 0;
+            _filesList[_filesCount].hash = 0;
             ++_filesCount;
          }
       }
@@ -127,7 +178,7 @@ FileSystem::~FileSystem() {
 	delete _impl;
 }
 
-char *FileSystem::findPath(const char *filename) const {
+const char *FileSystem::findPath(const char *filename) const {
 	return _impl->getPath(filename);
 }
 
@@ -17,7 +17,8 @@ struct FileSystem {
 
 	FileSystem_impl *_impl;
 
-	char *findPath(const char *filename) const;
+	/* full path of filename, owned by the FileSystem */
+	const char *findPath(const char *filename) const;
 	bool exists(const char *filename) const;
 };
 
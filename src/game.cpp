@@ -26,10 +26,6 @@ struct StateManager {
 	}
 };
 
-Options g_options = {};
-
-Game *Game::instance;
-
 Game::Game(FileSystem *fs, const char *savePath, int level, Language lang)
 	: _cut(&_res, this, &_vid), _menu(&_res, this, &_vid),
 	  _mix(fs, this), _res(fs, lang), _seq(&_vid, this, &_mix), _vid(&_res, this),
@@ -39,12 +35,14 @@ Game::Game(FileSystem *fs, const char *savePath, int level, Language lang)
 	_skillLevel    = _menu._skill = 1;
 	_currentLevel  = _menu._level = level;
 	_demoBin       = -1;
+	_outputSampleRate = 44100;
+	setFrameRate(50);
 	memset(&_pi, 0, sizeof(PlayerInput));
-	Game::instance = this;
+	memset(&_options, 0, sizeof(_options));
+	_saveWriter.setCallback(saveStateWritten, this);
 }
 
 Game::~Game() {
-	Game::instance = NULL;
 }
 
 void Game::init() {
@@ -54,7 +52,7 @@ void Game::init() {
 	_res.load_TEXT();
 
 	_res.load("FB_TXT", Resource::OT_FNT);
-	if (g_options.use_seq_cutscenes) {
+	if (_options.use_seq_cutscenes) {
 		_res._hasSeqData = _fs->exists("INTRO.SEQ");
 	}
 	if (_fs->exists("logosssi.cmd")) {
@@ -156,7 +154,42 @@ enum { TR_FRAME = 0, TR_POP = 1, TR_CALL = 2 };
 void Game::runFrame() {
 	if (_taskTop < 0)
 		return; /* game finished */
-	_lastTimestamp += MS_PER_FRAME;
+	_saveWriter.poll();
+	if (_replay._mode != Replay::MODE_OFF)
+		replayBeginFrame();
+	const retro_time_t t = _prof.begin();
+	runTasks();
+	_prof.end(Profiler::PROF_FRAME, t);
+	_prof.endFrame();
+	if (_replay._mode != Replay::MODE_OFF)
+		replayEndFrame();
+}
+
+void Game::setFrameRate(uint32_t fps) {
+	if (_replay._mode == Replay::MODE_RECORD) {
+		/* the frames from here run at another rate */
+		_replay._segmentPending = true;
+	}
+	_frameRate         = fps;
+	_frameMs           = 1000 / fps;
+	_frameMsCarry      = 0;
+	_frameSamples      = getOutputSampleRate() / fps;
+	_frameSamplesCarry = 0;
+}
+
+void Game::setOutputSampleRate(uint32_t rate) {
+	_outputSampleRate = rate;
+	setFrameRate(_frameRate);
+}
+
+void Game::runTasks() {
+	_frameMsCarry      += 1000;
+	_frameMs            = _frameMsCarry / _frameRate;
+	_frameMsCarry      %= _frameRate;
+	_frameSamplesCarry += getOutputSampleRate();
+	_frameSamples       = _frameSamplesCarry / _frameRate;
+	_frameSamplesCarry %= _frameRate;
+	_lastTimestamp += _frameMs;
 	for (;;) {
 		if (_taskTop < 0) {
 			running = false;
@@ -173,6 +206,46 @@ void Game::runFrame() {
 	}
 }
 
+int Game::runFrames(int frames) {
+	int count = 0;
+	_vid._skipPresent = true;
+	for (; count < frames && _taskTop >= 0; ++count) {
+		runFrame();
+		_mix.skip(getFrameSamples());
+	}
+	_vid._skipPresent = false;
+	_vid.flushPresent();
+	return count;
+}
+
+bool Game::startDemo(int num) {
+	if (num < 0 || num >= (int) ARRAY_SIZE(_demoInputs) || _taskTop != 0 || _task[0].phase != 0) {
+		return false;
+	}
+	_res.load_DEM(_demoInputs[num].name);
+	if (_res._demLen == 0) {
+		return false;
+	}
+	_demoBin      = num;
+	_skillLevel   = 1;
+	_currentLevel = _demoInputs[num].level;
+	_randSeed     = 0;
+	_task[0].phase = 2; /* skip the intro cutscenes, as the menu did */
+	return true;
+}
+
+bool Game::startLevel(int level, int skill, uint32_t seed) {
+	if (level < 0 || level >= 7 || skill < 0 || skill > 2 || _taskTop != 0 || _task[0].phase != 0) {
+		return false;
+	}
+	_demoBin      = -1;
+	_skillLevel   = skill;
+	_currentLevel = level;
+	_randSeed     = seed;
+	_task[0].phase = 2;
+	return true;
+}
+
 int Game::pushTask(int tag) {
 	++_taskTop;
 	_task[_taskTop].tag   = tag;
@@ -212,7 +285,7 @@ void Game::addPaceDelay(int ms) {
 /* Consume one host frame quantum of pending pace delay. Returns true while a
  * whole quantum remains (the driver should present/hold another frame). */
 bool Game::paceHoldFrame() {
-	const int ms_per_frame = 1000 / getFrameRate();
+	const int ms_per_frame = _frameMs;
 	if ((int)_paceAccumMs >= ms_per_frame) {
 		_paceAccumMs -= ms_per_frame;
 		return true;
@@ -222,6 +295,13 @@ bool Game::paceHoldFrame() {
 
 /* ---- frame-driver task steps (stackless equivalent of run()/mainLoop()) ---- */
 
+bool Game::cutsceneMainLoopStep() {
+	const retro_time_t t = _prof.begin();
+	const bool ret = _cut.mainLoopStep();
+	_prof.end(Profiler::PROF_CUTSCENE, t);
+	return ret;
+}
+
 int Game::cutsceneTaskStep() {
 	int &ph = _task[_taskTop].phase;
 	for (;;) {
@@ -241,7 +321,7 @@ int Game::cutsceneTaskStep() {
 			ph = _cut.playSetup() ? 1 : 2;
 			break;
 		case 1: /* pump play() #1 */
-			if (_cut.mainLoopStep()) {
+			if (cutsceneMainLoopStep()) {
 				return TR_FRAME;
 			}
 			ph = 2;
@@ -258,7 +338,7 @@ int Game::cutsceneTaskStep() {
 			ph = 5;
 			break;
 		case 3: /* pump play() #2 (0x4A) */
-			if (_cut.mainLoopStep()) {
+			if (cutsceneMainLoopStep()) {
 				return TR_FRAME;
 			}
 			ph = 4;
@@ -468,11 +548,7 @@ int Game::runTaskStep() {
 			ph = 2;
 			return pushTask(TASK_CUTSCENE);
 		case 2:
-			_res.load("GLOBAL", Resource::OT_ICN);
-			_res.load("GLOBAL", Resource::OT_SPC);
-			_res.load("PERSO", Resource::OT_SPR);
-			_res.load_SPR_OFF("PERSO", _res._spr1);
-			_res.load_FIB("GLOBAL");
+			loadGlobalData();
 			ph = 3;
 			break;
 		case 3: /* level loop top */
@@ -574,6 +650,7 @@ int Game::mainLoopTaskStep() {
 				ph = 8;
 				return pushTask(TASK_CUTSCENE);
 			}
+			syncSaveStates();
 			if (_validSaveState) {
 				if (!loadGameState(0)) {
 					_endLoop = true;
@@ -590,10 +667,17 @@ int Game::mainLoopTaskStep() {
 			break;
 		case 6: /* gameplay logic + draw + present */
 		{
-			memcpy(_vid._frontLayer, _vid._backLayer, Video::GAMESCREEN_SIZE);
+			_vid.restoreBackLayer();
+			retro_time_t t = _prof.begin();
 			pge_getInput();
+			_prof.end(Profiler::PROF_PGE_GETINPUT, t);
+			t = _prof.begin();
 			pge_prepare();
+			_prof.end(Profiler::PROF_PGE_PREPARE, t);
+			t = _prof.begin();
 			col_prepareRoomState();
+			_prof.end(Profiler::PROF_COL_PREPARE, t);
+			t = _prof.begin();
 			uint8_t oldLevel = _currentLevel;
 			for (uint16_t i = 0; i < _res._pgeNum; ++i) {
 				LivePGE *pge = _pge_liveTable2[i];
@@ -603,6 +687,7 @@ int Game::mainLoopTaskStep() {
 					pge_process(pge);
 				}
 			}
+			_prof.end(Profiler::PROF_PGE_PROCESS, t);
 			if (oldLevel != _currentLevel) {
 				if (_res._isDemo) {
 					_currentLevel = oldLevel;
@@ -620,15 +705,22 @@ int Game::mainLoopTaskStep() {
 					_loadMap = false;
 				}
 			}
+			t = _prof.begin();
 			prepareAnims();
+			_prof.end(Profiler::PROF_PREPARE_ANIMS, t);
+			t = _prof.begin();
 			drawAnims();
+			_prof.end(Profiler::PROF_DRAW_ANIMS, t);
 			drawCurrentInventoryItem();
 			drawLevelTexts();
 			printLevelCode();
 			if (_blinkingConradCounter != 0) {
 				--_blinkingConradCounter;
 			}
-			_vid.copyRect(0, 0, Video::GAMESCREEN_W, Video::GAMESCREEN_H, _vid._frontLayer, 256);
+			/* only the spans touched by this and the previous frame's blits */
+			t = _prof.begin();
+			_vid.copyFrontLayer();
+			_prof.end(Profiler::PROF_PRESENT, t);
 			if (_vid._shakeOffset != 0) {
 				_vid._shakeOffset = 0;
 			}
@@ -652,6 +744,8 @@ int Game::mainLoopTaskStep() {
 		}
 		case 16: /* drain the pace, then the mainLoop tail */
 			if (paceHoldFrame()) {
+				/* nothing else runs on a held frame */
+				_vid.PC_prefetchRoom(_currentLevel);
 				return TR_FRAME;
 			}
 			_frameTimestamp = getTimeStamp();
@@ -719,13 +813,49 @@ uint32_t Game::getTimeStamp() {
 }
 
 void Game::processFragment(int16_t *stream, int len) {
+	const retro_time_t t = _prof.begin();
 	_mix.mix(stream, len);
+	_prof.end(Profiler::PROF_MIX, t);
 }
 
-uint32_t *Game::getFrameBuffer() {
+void *Game::getFrameBuffer() {
 	return _vid._frameBuffer;
 }
 
+unsigned Game::getFrameBufferPitch() {
+	return Video::GAMESCREEN_W * _vid.getBytesPerPixel();
+}
+
+size_t Game::getFrameBufferSize() {
+	return Video::GAMESCREEN_SIZE * _vid.getBytesPerPixel();
+}
+
+void Game::setPixelFormat(bool rgb565) {
+	_vid.setPixelFormat(rgb565 ? Video::PF_RGB565 : Video::PF_XRGB8888);
+}
+
+bool Game::setIndexedOutput(bool enable) {
+	return _vid.setIndexedOutput(enable);
+}
+
+const uint8_t *Game::getIndexedFrame() {
+	return _vid._indexedSurface;
+}
+
+const uint32_t *Game::getPalette() {
+	return _vid._rgbPalette;
+}
+
+uint32_t Game::getPaletteGeneration() {
+	return _vid._paletteGen;
+}
+
+bool Game::consumeFrameDirty() {
+	const bool dirty = _vid._frameDirty;
+	_vid._frameDirty = false;
+	return dirty;
+}
+
 void Game::resetGameState() {
 	_animBuffers._states[0] = _animBuffer0State;
 	_animBuffers._curPos[0] = 0xFF;
@@ -763,6 +893,7 @@ void Game::mainLoop() {
 				playCutscene(0x41);
 				_endLoop = true;
 			} else {
+				syncSaveStates();
 				if (_validSaveState) {
 					if (!loadGameState(0))
 						_endLoop = true;
@@ -1180,6 +1311,7 @@ StepResult Game::handleContinueAbortStep() {
 		_paceAccumMs += 100;
 		--_caTimeout;
 		memcpy(_vid._frontLayer, _vid._tempLayer, Video::GAMESCREEN_SIZE);
+		_vid.invalidateFrontLayer();
 	}
 	if (paceHoldFrame()) {
 		return STEP_RUNNING; /* draining addPaceDelay(100): re-present current frame */
@@ -1375,6 +1507,7 @@ StepResult Game::drawStoryTextsStep() {
 					}
 					++_stStr;
 					memcpy(_vid._frontLayer, _vid._tempLayer, Video::GAMESCREEN_SIZE);
+					_vid.invalidateFrontLayer();
 					_stPhase = ST_DRAW;
 					break; /* loop -> next segment in the same call */
 				}
@@ -1843,26 +1976,51 @@ bool Game::hasLevelMap(int level, int room) const {
 
 void Game::loadLevelMap() {
 	_currentIcon = 0xFF;
-	if (_res._map) {
-		_vid.PC_decodeMap(_currentLevel, _currentRoom);
-	} else if (_res._lev) {
-		_vid.PC_decodeLev(_currentLevel, _currentRoom);
-	}
+	_vid.PC_loadRoom(_currentLevel, _currentRoom);
 	_vid.PC_setLevelPalettes();
+	queueAdjacentRooms();
+}
+
+/* The rooms the player can walk to next, decoded on the held frames */
+void Game::queueAdjacentRooms() {
+	static const int kDirections[] = { CT_LEFT_ROOM, CT_RIGHT_ROOM, CT_UP_ROOM, CT_DOWN_ROOM };
+	uint8_t rooms[4];
+	int count = 0;
+	if (_currentRoom < 0x40) {
+		for (unsigned i = 0; i < ARRAY_SIZE(kDirections); ++i) {
+			const int room = _res._ctData[kDirections[i] + _currentRoom];
+			if (room >= 0 && room < 0x40 && hasLevelMap(_currentLevel, room)) {
+				rooms[count++] = room;
+			}
+		}
+	}
+	_vid._roomCache.setPending(_currentLevel, rooms, count);
+}
+
+void Game::loadGlobalData() {
+	_res.load("GLOBAL", Resource::OT_ICN);
+	_res.load("GLOBAL", Resource::OT_SPC);
+	_res.load("PERSO", Resource::OT_SPR);
+	_res.load_SPR_OFF("PERSO", _res._spr1);
+	_res.load_FIB("GLOBAL");
 }
 
 void Game::loadLevelData() {
+	_stateHash.reset();
 	_res.clearLevelRes();
 	const Level *lvl = &_gameLevels[_currentLevel];
-	_res.load(lvl->name, Resource::OT_MBK);
-	_res.load(lvl->name, Resource::OT_CT);
-	_res.load(lvl->name, Resource::OT_PAL);
-	_res.load(lvl->name, Resource::OT_RP);
-	_res.load(lvl->name, Resource::OT_MAP);
-	_res.load(lvl->name2, Resource::OT_PGE);
-	_res.load(lvl->name2, Resource::OT_OBJ);
-	_res.load(lvl->name2, Resource::OT_ANI);
-	_res.load(lvl->name2, Resource::OT_TBN);
+	if (!_res.loadCachedLevelRes(_currentLevel) && !_prefetch.adopt(_currentLevel, &_res)) {
+		_res.load(lvl->name, Resource::OT_MBK);
+		_res.load(lvl->name, Resource::OT_CT);
+		_res.load(lvl->name, Resource::OT_PAL);
+		_res.load(lvl->name, Resource::OT_RP);
+		_res.load(lvl->name, Resource::OT_MAP);
+		_res.load(lvl->name2, Resource::OT_PGE);
+		_res.load(lvl->name2, Resource::OT_OBJ);
+		_res.load(lvl->name2, Resource::OT_ANI);
+		_res.load(lvl->name2, Resource::OT_TBN);
+		_res.cacheLevelRes(_currentLevel);
+	}
 
 	_cut._id = lvl->cutscene_id;
 	if (_res._isDemo && _currentLevel == 5) { // PC demo does not include TELEPORT.*
@@ -1910,6 +2068,16 @@ void Game::loadLevelData() {
 	_validSaveState = false;
 
 	_mix.playMusic(Mixer::MUSIC_TRACK + lvl->track);
+	prefetchNextLevel();
+}
+
+/* The levels are played in the _gameLevels order, the next one is staged
+ * while this one is played. Level 7 is the ending, it has no data. */
+void Game::prefetchNextLevel() {
+	const int next = _currentLevel + 1;
+	if (next < 7 && !_res._isDemo) {
+		_prefetch.request(next, &_res);
+	}
 }
 
 void Game::drawIcon(uint8_t iconNum, int16_t x, int16_t y, uint8_t colMask) {
@@ -2139,18 +2307,6 @@ void Game::resumeLoadedGameplay() {
 	_state          = STATE_MAIN_LOOP; /* parked state so a re-serialize sees gameplay */
 }
 
-/* RetroArch save: versioned header, gameplay-only (nothing to capture during a
- * cutscene). */
-bool Game::serializeState(File *f) {
-	if (!isStateMainLoop()) {
-		return false;
-	}
-	f->writeUint32BE(TAG_FBSV);
-	f->writeUint16BE(SAVE_STATE_VERSION);
-	saveState(f);
-	return !f->ioErr();
-}
-
 /* RetroArch load: validate the versioned header, then load the (level-self-
  * contained) state and resume gameplay -- allowed even from the intro so
  * RetroArch's auto-load-state works at launch (issue #14). Old, unversioned or
@@ -2179,96 +2335,105 @@ bool Game::unserializeState(File *f) {
 }
 
 bool Game::saveGameState(uint8_t slot) {
-	bool success = false;
 	char stateFile[20];
 	makeGameStateName(slot, stateFile);
+	/* the state is taken now, the write happens in the background */
+	MemFile *mf = new MemFile;
 	File f;
-	if (!f.open(stateFile, "wb", _savePath)) {
+	f.open(mf);
+	// header
+	f.writeUint32BE(TAG_FBSV);
+	f.writeUint16BE(SAVE_STATE_VERSION);
+	char buf[32];
+	memset(buf, 0, sizeof(buf));
+	snprintf(buf, sizeof(buf), "level=%d room=%d", _currentLevel + 1, _currentRoom);
+	f.write(buf, sizeof(buf));
+	// contents
+	saveState(&f);
+	if (f.ioErr()) {
+		log_cb(RETRO_LOG_WARN, "I/O error when saving game state\n");
+		free(mf->_mem);
+		return false;
+	}
+	_saveWriter.post(_savePath, stateFile, mf->_mem, mf->_size, slot);
+	return true;
+}
+
+void Game::saveStateWritten(void *userData, int slot, bool success) {
+	Game *g = (Game *)userData;
+	if (!success) {
+		char stateFile[20];
+		g->makeGameStateName(slot, stateFile);
 		log_cb(RETRO_LOG_WARN, "Unable to save state file '%s'\n", stateFile);
-	} else {
-		// header
-		f.writeUint32BE(TAG_FBSV);
-		f.writeUint16BE(SAVE_STATE_VERSION);
-		char buf[32];
-		memset(buf, 0, sizeof(buf));
-		snprintf(buf, sizeof(buf), "level=%d room=%d", _currentLevel + 1, _currentRoom);
-		f.write(buf, sizeof(buf));
-		// contents
-		saveState(&f);
-		if (f.ioErr()) {
-			log_cb(RETRO_LOG_WARN, "I/O error when saving game state\n");
-		} else {
-			success = true;
+	}
+	if (slot == 0) {
+		/* checkpoint from pge_op_saveState */
+		g->_saveStateCompleted = success;
+		if (!success) {
+			g->_validSaveState = false;
 		}
 	}
-	return success;
 }
 
+void Game::syncSaveStates() {
+	_saveWriter.flush();
+	_saveWriter.poll();
+}
+
+/* saveState() record sizes */
+static const int kPgeStateSize  = 30;
+static const int kCol2StateSize = 25;
+
 void Game::saveState(File *f) {
 	f->writeByte(_skillLevel);
 	f->writeByte(_currentLevel); /* level the state belongs to (v3) */
-	f->writeUint32BE(_score);
-	if (_col_slots2Cur == 0) {
-		f->writeUint32BE(0xFFFFFFFF);
-	} else {
-		f->writeUint32BE(_col_slots2Cur - &_col_slots2[0]);
-	}
-	if (_col_slots2Next == 0) {
-		f->writeUint32BE(0xFFFFFFFF);
-	} else {
-		f->writeUint32BE(_col_slots2Next - &_col_slots2[0]);
-	}
-	for (int i = 0; i < _res._pgeNum; ++i) {
+	uint32_t hdr[3];
+	hdr[0] = _score;
+	hdr[1] = (_col_slots2Cur == 0) ? 0xFFFFFFFF : _col_slots2Cur - &_col_slots2[0];
+	hdr[2] = (_col_slots2Next == 0) ? 0xFFFFFFFF : _col_slots2Next - &_col_slots2[0];
+	f->writeUint32BE(hdr, 3);
+	/* the records are packed in a buffer and written at once */
+	uint8_t buf[256 * kPgeStateSize];
+	uint8_t *p = buf;
+	for (int i = 0; i < _res._pgeNum; ++i, p += kPgeStateSize) {
 		LivePGE *pge = &_pgeLive[i];
-		f->writeUint16BE(pge->obj_type);
-		f->writeUint16BE(pge->pos_x);
-		f->writeUint16BE(pge->pos_y);
-		f->writeByte(pge->anim_seq);
-		f->writeByte(pge->room_location);
-		f->writeUint16BE(pge->life);
-		f->writeUint16BE(pge->counter_value);
-		f->writeByte(pge->collision_slot);
-		f->writeByte(pge->next_inventory_PGE);
-		f->writeByte(pge->current_inventory_PGE);
-		f->writeByte(pge->unkF);
-		f->writeUint16BE(pge->anim_number);
-		f->writeByte(pge->flags);
-		f->writeByte(pge->index);
-		f->writeUint16BE(pge->first_obj_number);
-		if (pge->next_PGE_in_room == 0) {
-			f->writeUint32BE(0xFFFFFFFF);
-		} else {
-			f->writeUint32BE(pge->next_PGE_in_room - &_pgeLive[0]);
-		}
-		if (pge->init_PGE == 0) {
-			f->writeUint32BE(0xFFFFFFFF);
-		} else {
-			f->writeUint32BE(pge->init_PGE - &_res._pgeInit[0]);
-		}
-	}
+		WRITE_BE_UINT16(p, pge->obj_type);
+		WRITE_BE_UINT16(p + 2, pge->pos_x);
+		WRITE_BE_UINT16(p + 4, pge->pos_y);
+		p[6] = pge->anim_seq;
+		p[7] = pge->room_location;
+		WRITE_BE_UINT16(p + 8, pge->life);
+		WRITE_BE_UINT16(p + 10, pge->counter_value);
+		p[12] = pge->collision_slot;
+		p[13] = pge->next_inventory_PGE;
+		p[14] = pge->current_inventory_PGE;
+		p[15] = pge->unkF;
+		WRITE_BE_UINT16(p + 16, pge->anim_number);
+		p[18] = pge->flags;
+		p[19] = pge->index;
+		WRITE_BE_UINT16(p + 20, pge->first_obj_number);
+		WRITE_BE_UINT32(p + 22, (pge->next_PGE_in_room == 0) ? 0xFFFFFFFF : pge->next_PGE_in_room - &_pgeLive[0]);
+		WRITE_BE_UINT32(p + 26, (pge->init_PGE == 0) ? 0xFFFFFFFF : pge->init_PGE - &_res._pgeInit[0]);
+	}
+	f->write(buf, p - buf);
 	f->write(&_res._ctData[0x100], 0x1C00);
-	for (CollisionSlot2 *cs2 = &_col_slots2[0]; cs2 < _col_slots2Cur; ++cs2) {
-		if (cs2->next_slot == 0) {
-			f->writeUint32BE(0xFFFFFFFF);
-		} else {
-			f->writeUint32BE(cs2->next_slot - &_col_slots2[0]);
-		}
-		if (cs2->unk2 == 0) {
-			f->writeUint32BE(0xFFFFFFFF);
-		} else {
-			f->writeUint32BE(cs2->unk2 - &_res._ctData[0x100]);
-		}
-		f->writeByte(cs2->data_size);
-		f->write(cs2->data_buf, 0x10);
+	p = buf;
+	for (CollisionSlot2 *cs2 = &_col_slots2[0]; cs2 < _col_slots2Cur; ++cs2, p += kCol2StateSize) {
+		WRITE_BE_UINT32(p, (cs2->next_slot == 0) ? 0xFFFFFFFF : cs2->next_slot - &_col_slots2[0]);
+		WRITE_BE_UINT32(p + 4, (cs2->unk2 == 0) ? 0xFFFFFFFF : cs2->unk2 - &_res._ctData[0x100]);
+		p[8] = cs2->data_size;
+		memcpy(p + 9, cs2->data_buf, 0x10);
 	}
+	f->write(buf, p - buf);
 }
 
 bool Game::loadGameState(uint8_t slot) {
 	bool success = false;
 	char stateFile[20];
 	makeGameStateName(slot, stateFile);
+	syncSaveStates();
 	File f;
-	if (!f.open(stateFile, "zrb", _savePath)) {
+	if (!_savePath || !f.open(stateFile, "zrb", _savePath)) {
 		log_cb(RETRO_LOG_WARN, "Unable to open state file '%s'\n", stateFile);
 	} else {
 		uint32_t id = f.readUint32BE();
@@ -2304,6 +2469,8 @@ void Game::loadState(File *f) {
 		f->setIoErr();
 		return;
 	}
+	replayStateLoaded();
+	_stateHash.reset();
 	if (savedLevel != _currentLevel) {
 		/* switch to the saved level: loadLevelData() reloads the level's
 		 * resources and re-inits _pgeLive/tables, so it MUST run before the
@@ -2315,10 +2482,12 @@ void Game::loadState(File *f) {
 		loadLevelData();
 		_cut._id = 0xFFFF;
 	}
-	_score      = f->readUint32BE();
+	uint32_t hdr[3];
+	f->readUint32BE(hdr, 3);
+	_score      = hdr[0];
 	memset(_pge_liveTable2, 0, sizeof(_pge_liveTable2));
 	memset(_pge_liveTable1, 0, sizeof(_pge_liveTable1));
-	off    = f->readUint32BE();
+	off    = hdr[1];
 	if (off == 0xFFFFFFFF) {
 		_col_slots2Cur = 0;
 	} else if (off <= 256) {
@@ -2327,7 +2496,7 @@ void Game::loadState(File *f) {
 		_col_slots2Cur = 0;
 		f->setIoErr();
 	}
-	off    = f->readUint32BE();
+	off    = hdr[2];
 	if (off == 0xFFFFFFFF) {
 		_col_slots2Next = 0;
 	} else if (off <= 256) {
@@ -2336,24 +2505,30 @@ void Game::loadState(File *f) {
 		_col_slots2Next = 0;
 		f->setIoErr();
 	}
-	for (i = 0; i < _res._pgeNum; ++i) {
+	/* the records are read at once, then decoded */
+	uint8_t buf[256 * kPgeStateSize];
+	if (f->read(buf, _res._pgeNum * kPgeStateSize) != (uint32_t)(_res._pgeNum * kPgeStateSize)) {
+		memset(buf, 0, sizeof(buf));
+	}
+	const uint8_t *p = buf;
+	for (i = 0; i < _res._pgeNum; ++i, p += kPgeStateSize) {
 		LivePGE *pge = &_pgeLive[i];
-		pge->obj_type              = f->readUint16BE();
-		pge->pos_x                 = f->readUint16BE();
-		pge->pos_y                 = f->readUint16BE();
-		pge->anim_seq              = f->readByte();
-		pge->room_location         = f->readByte();
-		pge->life                  = f->readUint16BE();
-		pge->counter_value         = f->readUint16BE();
-		pge->collision_slot        = f->readByte();
-		pge->next_inventory_PGE    = f->readByte();
-		pge->current_inventory_PGE = f->readByte();
-		pge->unkF                  = f->readByte();
-		pge->anim_number           = f->readUint16BE();
-		pge->flags                 = f->readByte();
-		pge->index                 = f->readByte();
-		pge->first_obj_number      = f->readUint16BE();
-		off = f->readUint32BE();
+		pge->obj_type              = READ_BE_UINT16(p);
+		pge->pos_x                 = READ_BE_UINT16(p + 2);
+		pge->pos_y                 = READ_BE_UINT16(p + 4);
+		pge->anim_seq              = p[6];
+		pge->room_location         = p[7];
+		pge->life                  = READ_BE_UINT16(p + 8);
+		pge->counter_value         = READ_BE_UINT16(p + 10);
+		pge->collision_slot        = p[12];
+		pge->next_inventory_PGE    = p[13];
+		pge->current_inventory_PGE = p[14];
+		pge->unkF                  = p[15];
+		pge->anim_number           = READ_BE_UINT16(p + 16);
+		pge->flags                 = p[18];
+		pge->index                 = p[19];
+		pge->first_obj_number      = READ_BE_UINT16(p + 20);
+		off = READ_BE_UINT32(p + 22);
 		if (off == 0xFFFFFFFF) {
 			pge->next_PGE_in_room = 0;
 		} else if (off < 256) {
@@ -2362,7 +2537,7 @@ void Game::loadState(File *f) {
 			pge->next_PGE_in_room = 0;
 			f->setIoErr();
 		}
-		off = f->readUint32BE();
+		off = READ_BE_UINT32(p + 26);
 		if (off == 0xFFFFFFFF) {
 			pge->init_PGE = 0;
 		} else if (off < 256) {
@@ -2373,8 +2548,13 @@ void Game::loadState(File *f) {
 		}
 	}
 	f->read(&_res._ctData[0x100], 0x1C00);
-	for (CollisionSlot2 *cs2 = &_col_slots2[0]; cs2 < _col_slots2Cur; ++cs2) {
-		off = f->readUint32BE();
+	const uint32_t col2Size = (_col_slots2Cur - &_col_slots2[0]) * kCol2StateSize;
+	if (f->read(buf, col2Size) != col2Size) {
+		memset(buf, 0, col2Size);
+	}
+	p = buf;
+	for (CollisionSlot2 *cs2 = &_col_slots2[0]; cs2 < _col_slots2Cur; ++cs2, p += kCol2StateSize) {
+		off = READ_BE_UINT32(p);
 		if (off == 0xFFFFFFFF) {
 			cs2->next_slot = 0;
 		} else if (off < 256) {
@@ -2383,7 +2563,7 @@ void Game::loadState(File *f) {
 			cs2->next_slot = 0;
 			f->setIoErr();
 		}
-		off            = f->readUint32BE();
+		off            = READ_BE_UINT32(p + 4);
 		if (off == 0xFFFFFFFF) {
 			cs2->unk2 = 0;
 		} else if (off < 0x1C00) {
@@ -2392,8 +2572,8 @@ void Game::loadState(File *f) {
 			cs2->unk2 = 0;
 			f->setIoErr();
 		}
-		cs2->data_size = f->readByte();
-		f->read(cs2->data_buf, 0x10);
+		cs2->data_size = p[8];
+		memcpy(cs2->data_buf, p + 9, 0x10);
 	}
 	for (i = 0; i < _res._pgeNum; ++i) {
 		if (_res._pgeInit[i].skill <= _skillLevel) {
@@ -9,14 +9,18 @@
 
 #include "intern.h"
 #include "cutscene.h"
+#include "level_prefetch.h"
 #include "menu.h"
 #include "mixer.h"
+#include "profiler.h"
+#include "replay.h"
 #include "resource.h"
+#include "rewind.h"
+#include "save_writer.h"
 #include "seq_player.h"
+#include "state_hash.h"
 #include "video.h"
 
-#define MS_PER_FRAME (1000/50)
-
 struct File;
 struct FileSystem;
 
@@ -50,6 +54,8 @@ struct PlayerInput {
 	bool    quit;
 };
 
+struct SnapshotStream;
+
 struct Game {
 	typedef int (Game::*pge_OpcodeProc)(ObjectOpcodeArgs *args);
 	typedef int (Game::*pge_ZOrderCallback)(LivePGE *, LivePGE *, uint8_t, uint8_t);
@@ -73,8 +79,6 @@ struct Game {
 		STATE_FINAL_SCORE,
 	};
 
-	static Game *instance;
-
 	static const Demo           _demoInputs[3];
 	static const Level          _gameLevels[];
 	static const uint16_t       _scoreTable[];
@@ -97,8 +101,15 @@ struct Game {
 	Resource   _res;
 	SeqPlayer  _seq;
 	Video      _vid;
+	Profiler   _prof;
+	RewindBuffer _rewind;
+	Replay     _replay;
+	StateHash  _stateHash;
+	SaveWriter _saveWriter;
+	LevelPrefetcher _prefetch;
 	FileSystem *_fs;
 	const char *_savePath;
+	Options    _options;
 
 	const uint8_t   *_stringsTable;
 	const char      **_textsTable;
@@ -176,12 +187,22 @@ struct Game {
 	int  _cutPushId; /* original playCutscene() id arg for the cutscene task */
 	/* Frame-pacing accumulator (milliseconds), formerly _sleep. Subsystems add
 	 * their timed delay via addPaceDelay(); paceHoldFrame() drains one host
-	 * frame quantum (MS_PER_FRAME) per runFrame(), re-presenting the current
+	 * frame quantum (_frameMs) per runFrame(), re-presenting the current
 	 * image while any remains. Kept in ms (not a frame count) so sub-quantum
 	 * delays -- e.g. the ~13ms gameplay pause that yields 30Hz on a 50Hz host --
 	 * accumulate their fractional remainder correctly. */
 	uint32_t    _paceAccumMs;
 	uint32_t    _lastTimestamp;
+	/* Host frame rate. A host frame lasts 1000/_frameRate ms, handed out as
+	 * whole _frameMs with the remainder carried over (16, 17, 17 ms at 60Hz);
+	 * the output samples per frame are split the same way. At the default
+	 * 50Hz this is a constant 20ms and 882 samples. The game logic keeps its
+	 * own 30Hz cadence through the pace accumulator. */
+	uint32_t    _frameRate;
+	uint32_t    _frameMs;
+	uint32_t    _frameMsCarry;
+	uint32_t    _frameSamples;
+	uint32_t    _frameSamplesCarry;
 	int         _state;
 
 	Game(FileSystem *, const char *savePath, int level, Language lang);
@@ -190,6 +211,20 @@ struct Game {
 	void init();
 	void run();
 	void runFrame();
+	void runTasks();
+	/* Turbo mode for headless runs: the same as `frames` runFrame() calls each
+	 * followed by a processFragment() of one frame of samples, but
+	 * intermediate presents are not converted and no audio is rendered, so
+	 * held pace frames cost next to nothing. The game state evolves exactly
+	 * as on the normal path. Returns the number of frames run, less than
+	 * asked if the game ended. */
+	int runFrames(int frames);
+	/* Replays the built-in demo num (_demoInputs) in place of the intro. Only
+	 * valid right after init(), before the first runFrame(). */
+	bool startDemo(int num);
+	/* Starts level (0-6) at skill (0-2) with the given random seed in place
+	 * of the intro, for headless runs. Same conditions as startDemo(). */
+	bool startLevel(int level, int skill, uint32_t seed);
 
 	void yield();
 	void addPaceDelay(int ms);
@@ -200,6 +235,7 @@ struct Game {
 	int  runTaskStep();
 	int  mainLoopTaskStep();
 	int  cutsceneTaskStep();
+	bool cutsceneMainLoopStep();
 	int  changeLevelTaskStep();
 	int  finalScoreTaskStep();
 	int  continueAbortTaskStep();
@@ -216,15 +252,42 @@ struct Game {
 
 	uint32_t getTimeStamp();
 
-	uint32_t getOutputSampleRate() { return 44100; };
+	uint32_t _outputSampleRate;
+	uint32_t getOutputSampleRate() { return _outputSampleRate; };
+	/* Mixer output rate; like setFrameRate(), set it before init() */
+	void setOutputSampleRate(uint32_t rate);
 
-	uint32_t getFrameRate() { return 50; };
+	uint32_t getFrameRate() { return _frameRate; };
+	void setFrameRate(uint32_t fps);
+	/* Output samples to mix for the frame just run */
+	uint32_t getFrameSamples() { return _frameSamples; };
 
 	bool isStateMainLoop() { return _state == STATE_MAIN_LOOP; }
 
 	bool isRunning() { return running; };
+	/* Fills len mono samples, no need to clear the buffer beforehand */
 	void processFragment(int16_t *stream, int len);
-	uint32_t *getFrameBuffer();
+	void *getFrameBuffer();
+	/* Bytes per framebuffer row and total size for the negotiated format */
+	unsigned getFrameBufferPitch();
+	size_t getFrameBufferSize();
+	void setPixelFormat(bool rgb565);
+	/* Zero-copy indexed output for hosts doing their own palette expansion:
+	 * with it enabled the core no longer fills getFrameBuffer(), the last
+	 * presented image is getIndexedFrame() (GAMESCREEN_W pitch) and its
+	 * XRGB8888 palette getPalette(), which changed whenever
+	 * getPaletteGeneration() did. Both stay valid until the next runFrame().
+	 * Returns false, with the mode left off, if the frame cannot be allocated.
+	 * Through libretro it is the reminiscence_indexed_output option and the
+	 * RE_MEMORY_* ids of retro_get_memory_data(). */
+	bool setIndexedOutput(bool enable);
+	const uint8_t *getIndexedFrame();
+	const uint32_t *getPalette();
+	uint32_t getPaletteGeneration();
+	/* True if the framebuffer was redrawn since the previous call. Held pace
+	 * frames (paceHoldFrame) leave it untouched, so the frontend can be told
+	 * to re-present the previous image instead. */
+	bool consumeFrameDirty();
 
 	void resetGameState();
 	void mainLoop();
@@ -233,7 +296,10 @@ struct Game {
 	bool playCutsceneSeq(const char *name);
 	bool hasLevelMap(int level, int room) const;
 	void loadLevelMap();
+	void queueAdjacentRooms();
+	void loadGlobalData();
 	void loadLevelData();
+	void prefetchNextLevel();
 	void drawIcon(uint8_t iconNum, int16_t x, int16_t y, uint8_t colMask);
 	void drawCurrentInventoryItem();
 	void printLevelCode();
@@ -505,16 +571,73 @@ struct Game {
 	bool    _validSaveState;
 
 	void makeGameStateName(uint8_t slot, char *buf);
+	/* Captures the state and hands it to _saveWriter: the file is written
+	 * in the background, saveStateWritten() reports the outcome. */
 	bool saveGameState(uint8_t slot);
+	static void saveStateWritten(void *userData, int slot, bool success);
+	/* waits for the pending save files and their completions */
+	void syncSaveStates();
 	bool loadGameState(uint8_t slot);
 	void saveState(File *f);
 	void loadState(File *f);
-	/* RetroArch serialize wrappers: versioned header + level-self-contained
-	 * state, and (on load) resume gameplay for the saved level even from the
-	 * intro. */
-	bool serializeState(File *f);
+	/* Legacy RetroArch state loader (the FBSV stream of saveState(), as
+	 * written by earlier cores): versioned header + level-self-contained
+	 * state, resuming gameplay for the saved level even from the intro. */
 	bool unserializeState(File *f);
 	void resumeLoadedGameplay();
+
+	// in-memory snapshots (snapshot.cpp)
+	size_t getSnapshotSize();
+	enum {
+		SNAPSHOT_OK,
+		SNAPSHOT_UNKNOWN, /* not a snapshot, maybe an FBSV stream */
+		SNAPSHOT_CORRUPT  /* rejected, the game is left as it was */
+	};
+	/* the snapshot length, 0 if size is below getSnapshotSize() */
+	size_t saveSnapshot(uint8_t *dst, size_t size);
+	/* Restores a saveSnapshot() image; within the current level it is applied
+	 * in place, without reloading the level or restarting the gameplay task */
+	int loadSnapshot(const uint8_t *src, size_t size);
+	void snapshotTransfer(SnapshotStream &s);
+
+	/* In-core rewind over snapshots: rewindPush() records the state at the
+	 * start of a frame, rewindStep() goes back to the last recorded one. */
+	bool setRewindBudget(uint32_t bytes); /* 0 disables */
+	void rewindPush();
+	bool rewindStep();
+	uint32_t getRewindFrames() { return _rewind.getCount(); };
+
+	/* Replays (replay.cpp): startRecording() snapshots the current state
+	 * and logs the input and state hash of every following runFrame(); a
+	 * state load or a change of rate starts a new segment from a fresh
+	 * snapshot. stopRecording() writes the log to f (NULL discards it).
+	 * startReplay() restores the first snapshot and rates of a log and
+	 * plays its inputs back from the next runFrame(), restoring each
+	 * segment as it comes and comparing the hashes, until isReplaying()
+	 * goes false. */
+	bool startRecording();
+	bool replayStartSegment();
+	bool replayLoadSegment(const Replay::Segment *seg);
+	bool stopRecording(File *f);
+	bool isRecording() { return _replay._mode == Replay::MODE_RECORD; };
+	bool startReplay(File *f);
+	bool isReplaying() { return _replay._mode == Replay::MODE_VERIFY; };
+	uint32_t getReplayMismatches() { return _replay._mismatches; };
+	void replayBeginFrame();
+	void replayEndFrame();
+	void replayStateLoaded();
+	void finishReplay();
+	/* Sets _pi from a replay input mask, for drivers feeding their own */
+	void setInputMask(uint16_t mask);
+
+	/* Hash of the simulation state (state_hash.cpp): PGEs and their groups,
+	 * collision grid and slots, random seed, score and task stack. Equal
+	 * states hash the same in any instance, so it can be compared between
+	 * netplay peers each frame. The groups, the collision grid and its
+	 * slots are only gathered again once marked dirty by the code writing
+	 * them; the PGEs and the per-frame collision slots are gathered up to
+	 * the entries in use. Only the chunks that changed are rehashed. */
+	uint32_t getStateHash();
 };
 
 #endif // GAME_H__
@@ -45,6 +45,4 @@ struct AnimBuffers {
 	              uint8_t h);
 };
 
-extern Options    g_options;
-
 #endif // INTERN_H__
@@ -29,6 +29,20 @@ static INLINE uint32_t READ_LE_UINT32(const void *ptr) {
 	return (b[3] << 24) | (b[2] << 16) | (b[1] << 8) | b[0];
 }
 
+static INLINE void WRITE_BE_UINT16(void *ptr, uint16_t n) {
+	uint8_t *b = (uint8_t *) ptr;
+	b[0] = n >> 8;
+	b[1] = n & 0xFF;
+}
+
+static INLINE void WRITE_BE_UINT32(void *ptr, uint32_t n) {
+	uint8_t *b = (uint8_t *) ptr;
+	b[0] = n >> 24;
+	b[1] = (n >> 16) & 0xFF;
+	b[2] = (n >> 8) & 0xFF;
+	b[3] = n & 0xFF;
+}
+
 static INLINE int8_t ADDC_S8(int a, int b) {
 	a += b;
 	if (a < -128)
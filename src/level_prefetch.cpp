@@ -0,0 +1,165 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "file.h"
+#include "game.h"
+#include "level_prefetch.h"
+
+LevelPrefetcher::LevelPrefetcher()
+	: _enabled(true) {
+#ifdef HAVE_STD_THREADS
+	_staging = 0;
+	_quit = false;
+	_requested = _loading = -1;
+	_ready = 0;
+	_readyMappedCount = 0;
+#endif
+}
+
+LevelPrefetcher::~LevelPrefetcher() {
+#ifdef HAVE_STD_THREADS
+	if (_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+		}
+		_cond.notify_one();
+		_thread.join();
+	}
+	if (_ready) {
+		discardReady(_staging);
+	}
+	delete _staging;
+#endif
+}
+
+void LevelPrefetcher::setEnabled(bool enabled, Resource *res) {
+	if (!enabled) {
+		cancel(res);
+	}
+	_enabled = enabled;
+}
+
+void LevelPrefetcher::request(int level, Resource *res) {
+#ifdef HAVE_STD_THREADS
+	if (!_enabled || res->isLevelResCached(level)) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_loading == level || (_ready && _ready->level == level)) {
+			return;
+		}
+		if (_ready) {
+			discardReady(res);
+		}
+		_requested = level;
+		if (!_staging) {
+			_staging = new Resource(res->_fs, res->_lang);
+			_staging->init();
+		}
+		if (!_thread.joinable()) {
+			_thread = std::thread(&LevelPrefetcher::run, this);
+		}
+	}
+	_cond.notify_one();
+#endif
+}
+
+bool LevelPrefetcher::adopt(int level, Resource *res) {
+#ifdef HAVE_STD_THREADS
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (_loading == level) {
+		_cond.wait(lock);
+	}
+	if (_requested == level) {
+		/* not started yet, loading it now is as quick */
+		_requested = -1;
+	}
+	if (_ready && _ready->level == level) {
+		res->adoptLevelRes(_ready, _readyMapped, _readyMappedCount);
+		_ready = 0;
+		_readyMappedCount = 0;
+		_cond.notify_one();
+		return true;
+	}
+	if (_ready) {
+		discardReady(res);
+	}
+#endif
+	return false;
+}
+
+void LevelPrefetcher::cancel(Resource *res) {
+#ifdef HAVE_STD_THREADS
+	std::unique_lock<std::mutex> lock(_mutex);
+	_requested = -1;
+	while (_loading >= 0) {
+		_cond.wait(lock);
+	}
+	if (_ready) {
+		discardReady(res);
+	}
+#endif
+}
+
+#ifdef HAVE_STD_THREADS
+/* Called with the mutex held. The staged buffers are not known to res: the
+ * mapped ones are unmapped here, the others freed by freeLevelRes(). */
+void LevelPrefetcher::discardReady(Resource *res) {
+	uint8_t **buffers[] = { &_ready->mbk, &_ready->map, &_ready->lev, &_ready->sgd, &_ready->bnq };
+	for (int i = 0; i < _readyMappedCount; ++i) {
+		for (unsigned j = 0; j < ARRAY_SIZE(buffers); ++j) {
+			if (*buffers[j] == _readyMapped[i].ptr) {
+				*buffers[j] = 0;
+			}
+		}
+		File::unmap(_readyMapped[i].ptr, _readyMapped[i].size);
+	}
+	res->freeLevelRes(_ready);
+	_ready = 0;
+	_readyMappedCount = 0;
+	_cond.notify_one();
+}
+
+/* The same loads as Game::loadLevelData() */
+void LevelPrefetcher::run() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (;;) {
+		/* a staged level waits to be adopted or dropped */
+		while (!_quit && (_requested < 0 || _ready)) {
+			_cond.wait(lock);
+		}
+		if (_quit) {
+			return;
+		}
+		const int level = _loading = _requested;
+		_requested = -1;
+		lock.unlock();
+		const Level *lvl = &Game::_gameLevels[level];
+		_staging->clearLevelRes();
+		_staging->load(lvl->name, Resource::OT_MBK);
+		_staging->load(lvl->name, Resource::OT_CT);
+		_staging->load(lvl->name, Resource::OT_PAL);
+		_staging->load(lvl->name, Resource::OT_RP);
+		_staging->load(lvl->name, Resource::OT_MAP);
+		_staging->load(lvl->name2, Resource::OT_PGE);
+		_staging->load(lvl->name2, Resource::OT_OBJ);
+		_staging->load(lvl->name2, Resource::OT_ANI);
+		_staging->load(lvl->name2, Resource::OT_TBN);
+		MappedData mapped[5];
+		int mappedCount;
+		LevelRes *lr = _staging->detachLevelRes(level, mapped, &mappedCount);
+		lock.lock();
+		_loading = -1;
+		if (lr) {
+			_ready = lr;
+			memcpy(_readyMapped, mapped, sizeof(mapped));
+			_readyMappedCount = mappedCount;
+		}
+		_cond.notify_all();
+	}
+}
+#endif
@@ -0,0 +1,55 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef LEVEL_PREFETCH_H__
+#define LEVEL_PREFETCH_H__
+
+#include "intern.h"
+#include "resource.h"
+#ifdef HAVE_STD_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+/* Loads a level's resources on a worker thread, into a Resource of its own,
+ * while the previous level is played. loadLevelData() then adopts them
+ * instead of reading and unpacking the files during the level change. One
+ * level is staged at a time, a request for another one drops it. Without
+ * HAVE_STD_THREADS requests are ignored and the levels load as before. */
+struct LevelPrefetcher {
+	bool _enabled;
+#ifdef HAVE_STD_THREADS
+	Resource                *_staging;
+	std::thread             _thread;
+	std::mutex              _mutex;
+	std::condition_variable _cond;
+	bool                    _quit;
+	int                     _requested; /* level to load next, -1 if none */
+	int                     _loading;   /* level being loaded, -1 if none */
+	LevelRes                *_ready;
+	MappedData              _readyMapped[5];
+	int                     _readyMappedCount;
+#endif
+
+	LevelPrefetcher();
+	~LevelPrefetcher();
+
+	void setEnabled(bool enabled, Resource *res);
+	/* starts loading level in the background, for res to adopt later */
+	void request(int level, Resource *res);
+	/* loads level into res if it was prefetched, after clearLevelRes();
+	 * waits for it if it is still loading */
+	bool adopt(int level, Resource *res);
+	/* drops the staged level, if any, and any pending request */
+	void cancel(Resource *res);
+
+#ifdef HAVE_STD_THREADS
+	void discardReady(Resource *res);
+	void run();
+#endif
+};
+
+#endif // LEVEL_PREFETCH_H__
@@ -9,17 +9,55 @@
 #include "file.h"
 #include "fs.h"
 #include "game.h"
+#include "palconv.h"
 #include "video.h"
+#include <compat/strl.h>
 #include <file/file_path.h>
 #include <streams/file_stream.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 #define RE_VERSION "0.3.6"
 
-static const int kAudioHz = 44100;
 
-FileSystem  *fs;
-Game        *game;
-PlayerInput lastInput;
+/* Everything the core owns while a game is loaded. The libretro entry
+ * points drive this one context; apart from it only the static tables and
+ * the frontend callbacks are process-wide, so more Game instances can run
+ * in the same process. */
+struct CoreContext {
+	FileSystem  *fs;
+	Game        *game;
+	PlayerInput lastInput;
+	int16_t     joypad_bits;
+	unsigned    rewind_budget;
+	bool        indexed_output;
+	char        replay_dir[PATH_MAX_LENGTH];
+	/* audio stage buffers, grown to the largest frame seen */
+	int16_t     *audio_mono;
+	int16_t     *audio_stereo;
+	unsigned    audio_capacity;
+};
+
+static CoreContext core;
+
+/* retro_get_memory_data() ids of the indexed output, for hosts expanding
+ * the palette themselves: the GAMESCREEN_W x GAMESCREEN_H 8-bit image last
+ * presented, its 256 XRGB8888 colors and a uint32_t bumped whenever one of
+ * them changes. Only filled with reminiscence_indexed_output enabled. */
+#define RE_MEMORY_INDEXED_FRAME ((1 << 8) | RETRO_MEMORY_VIDEO_RAM)
+#define RE_MEMORY_PALETTE       ((2 << 8) | RETRO_MEMORY_VIDEO_RAM)
+#define RE_MEMORY_PALETTE_GEN   ((3 << 8) | RETRO_MEMORY_VIDEO_RAM)
+
+/* the benchmark drives the core through the entry points above and reads
+ * its statistics off the loaded game */
+Game *retro_core_game(void)
+{
+	return core.game;
+}
 
 retro_log_printf_t          log_cb;
 static retro_video_refresh_t       video_cb;
@@ -30,7 +68,9 @@ static retro_audio_sample_t        audio_cb;
 static retro_audio_sample_batch_t  audio_batch_cb;
 
 static bool libretro_supports_bitmasks = false;
-static int16_t joypad_bits;
+static bool libretro_can_dupe = false;
+static struct retro_perf_callback perf_cb;
+
 
 /************************************
  * libretro implementation
@@ -41,12 +81,32 @@ void retro_set_environment(retro_environment_t cb)
 {
 	struct retro_vfs_interface_info vfs_iface_info;
 
+	static const struct retro_variable vars[] = {
+#ifdef FRONTEND_SUPPORTS_RGB565
+		{ "reminiscence_pixel_format", "Pixel format (restart); XRGB8888|RGB565" },
+#endif
+		{ "reminiscence_framerate", "Host frame rate; 50|60|75|100|120|144" },
+		{ "reminiscence_audio_rate", "Audio output rate (restart); 44100|48000|32000|22050" },
+		{ "reminiscence_profiler", "Frame profiler (log every N frames); disabled|250|1000|5000" },
+		{ "reminiscence_rewind", "In-core rewind, hold L2 (buffer size); disabled|4MB|16MB|64MB" },
+		{ "reminiscence_replay", "Record replay to the save directory (restart); disabled|enabled" },
+		{ "reminiscence_level_cache", "Keep loaded levels in memory; 8MB|disabled|2MB|32MB" },
+		{ "reminiscence_level_prefetch", "Load the next level in the background; enabled|disabled" },
+		{ "reminiscence_room_cache", "Keep decoded rooms in memory; 4MB|disabled|1MB|16MB" },
+		{ "reminiscence_indexed_output", "Indexed video output, for hosts reading the frame from memory; disabled|enabled" },
+		{ NULL, NULL },
+	};
+
 	environ_cb = cb;
+	cb(RETRO_ENVIRONMENT_SET_VARIABLES, (void *) vars);
 
 	vfs_iface_info.required_interface_version = 1;
 	vfs_iface_info.iface                      = NULL;
 	if (cb(RETRO_ENVIRONMENT_GET_VFS_INTERFACE, &vfs_iface_info))
 		filestream_vfs_init(&vfs_iface_info);
+	/* the data files are only mapped from the host paths when the frontend
+	 * has no VFS of its own to read them through */
+	File::setMapping(vfs_iface_info.iface == NULL);
 }
 
 void retro_set_video_refresh(retro_video_refresh_t cb) { video_cb = cb; }
@@ -69,8 +129,8 @@ void retro_get_system_info(struct retro_system_info *info) {
 
 void retro_get_system_av_info(struct retro_system_av_info *info) {
 	memset(info, 0, sizeof(*info));
-	info->timing.fps            = 50.0;
-	info->timing.sample_rate    = kAudioHz;
+	info->timing.fps            = core.game ? core.game->getFrameRate() : 50.0;
+	info->timing.sample_rate    = core.game ? core.game->getOutputSampleRate() : 44100;
 	info->geometry.base_width   = Video::GAMESCREEN_W;
 	info->geometry.base_height  = Video::GAMESCREEN_H;
 	info->geometry.max_width    = 1024;
@@ -84,26 +144,31 @@ void retro_set_controller_port_device(unsigned port, unsigned device) {
 }
 
 size_t retro_serialize_size(void) {
-	return 128 * 1024; // arbitrary max size?
+	return core.game ? core.game->getSnapshotSize() : 0;
 }
 
 bool retro_serialize(void *data, size_t size)
 {
-   File f;
-   f.open(new MemFile(static_cast<uint8_t *>(data),
-            static_cast<uint32_t>(size)));
-   /* gameplay-only gate + versioned header live in serializeState() */
-   return game->serializeState(&f);
+   /* compact snapshot, taken at any frame; the rest of the buffer is
+    * cleared so equal states serialize to equal buffers */
+   const size_t len = core.game->saveSnapshot(static_cast<uint8_t *>(data), size);
+   if (len == 0)
+      return false;
+   memset(static_cast<uint8_t *>(data) + len, 0, size - len);
+   return true;
 }
 
 bool retro_unserialize(const void *data, size_t size)
 {
+   const int ret = core.game->loadSnapshot(static_cast<const uint8_t *>(data), size);
+   if (ret != Game::SNAPSHOT_UNKNOWN)
+      return ret == Game::SNAPSHOT_OK;
+   /* States from earlier cores carry the versioned saveState() stream,
+    * permitted even during the intro so auto-load-state works at launch. */
    File f;
    f.open(new ReadOnlyMemFile(static_cast<const uint8_t *>(data),
             static_cast<uint32_t>(size)));
-   /* Validates the versioned header and resumes gameplay for the saved level,
-    * permitted even during the intro so auto-load-state works at launch. */
-   return game->unserializeState(&f);
+   return core.game->unserializeState(&f);
 }
 
 void retro_cheat_reset(void) {}
@@ -115,6 +180,93 @@ void retro_cheat_set(unsigned index, bool enabled, const char *code)
 	(void) code;
 }
 
+static void check_variables(bool startup)
+{
+	struct retro_variable var;
+	int                   interval = 0;
+	unsigned              fps      = 50;
+	unsigned              level_cache;
+	unsigned              room_cache;
+	bool                  indexed_output;
+
+	if (startup)
+	{
+		var.key   = "reminiscence_audio_rate";
+		var.value = NULL;
+		if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && atoi(var.value) > 0)
+			core.game->setOutputSampleRate(atoi(var.value));
+
+		var.key   = "reminiscence_replay";
+		var.value = NULL;
+		if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && !strcmp(var.value, "enabled"))
+			core.game->startRecording();
+	}
+
+	var.key   = "reminiscence_framerate";
+	var.value = NULL;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		fps = atoi(var.value);
+	if (fps != 0 && fps != core.game->getFrameRate())
+	{
+		core.game->setFrameRate(fps);
+		if (!startup)
+		{
+			struct retro_system_av_info info;
+			retro_get_system_av_info(&info);
+			environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info);
+		}
+	}
+
+	var.key   = "reminiscence_profiler";
+	var.value = NULL;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		interval = atoi(var.value); /* "disabled" -> 0 */
+
+	if (interval > 0 && !perf_cb.get_time_usec && log_cb)
+		log_cb(RETRO_LOG_WARN, "[RE]: No perf interface, frame profiler disabled.\n");
+	core.game->_prof.setup(perf_cb.get_time_usec, interval);
+
+	var.key   = "reminiscence_rewind";
+	var.value = NULL;
+	core.rewind_budget = 0;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		core.rewind_budget = atoi(var.value) << 20; /* "disabled" -> 0 */
+	if (!core.game->setRewindBudget(core.rewind_budget))
+		core.rewind_budget = 0;
+
+	var.key   = "reminiscence_level_cache";
+	var.value = NULL;
+	level_cache = 8;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		level_cache = atoi(var.value); /* "disabled" -> 0 */
+	core.game->_res.setLevelCacheBudget(level_cache << 20);
+
+	var.key   = "reminiscence_level_prefetch";
+	var.value = NULL;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		core.game->_prefetch.setEnabled(strcmp(var.value, "disabled") != 0, &core.game->_res);
+
+	var.key   = "reminiscence_room_cache";
+	var.value = NULL;
+	room_cache = 4;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		room_cache = atoi(var.value); /* "disabled" -> 0 */
+	core.game->_vid._roomCache.setBudget(room_cache << 20);
+
+	var.key   = "reminiscence_indexed_output";
+	var.value = NULL;
+	indexed_output = false;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+		indexed_output = !strcmp(var.value, "enabled");
+	if (indexed_output != core.indexed_output)
+	{
+		if (core.game->setIndexedOutput(indexed_output))
+			core.indexed_output = indexed_output;
+		else if (log_cb)
+			log_cb(RETRO_LOG_WARN, "[RE]: Unable to allocate the indexed frame.\n");
+	}
+}
+
 static int detectVersion(FileSystem *fs)
 {
    unsigned i;
@@ -179,31 +331,59 @@ bool retro_load_game(const struct retro_game_info *info)
 		{0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_B,     "Draw / Holster"},
 		{0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A,     "Use"},
 		{0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_Y,     "Inventory / Skip"},
+		{0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_L2,    "Rewind"},
 
 		{0},
 	};
 
 	char *dataPath = strdup(info->path);
 	path_basedir(dataPath);
-	fs = new FileSystem(dataPath);
+	core.fs = new FileSystem(dataPath);
 	free(dataPath);
-	const int version = detectVersion(fs);
+	const int version = detectVersion(core.fs);
 	if (version != kResourceTypeDOS)
 		return false;
 
 	environ_cb(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, desc);
 
-	if (!environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+#ifdef FRONTEND_SUPPORTS_RGB565
+	struct retro_variable var;
+	var.key   = "reminiscence_pixel_format";
+	var.value = NULL;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && !strcmp(var.value, "RGB565"))
+	{
+		fmt = RETRO_PIXEL_FORMAT_RGB565;
+		if (!environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+		{
+			if (log_cb)
+				log_cb(RETRO_LOG_INFO, "[RE]: RGB565 is not supported, using XRGB8888.\n");
+			fmt = RETRO_PIXEL_FORMAT_XRGB8888;
+		}
+	}
+#endif
+
+	if (fmt == RETRO_PIXEL_FORMAT_XRGB8888 && !environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
    {
 		if (log_cb)
 			log_cb(RETRO_LOG_INFO, "[RE]: XRGB8888 is not supported.\n");
 		return false;
 	}
 
-	const Language language = detectLanguage(fs);
-	game = new Game(fs, "", 0, language);
-	game->init();
-	memset(&lastInput, 0, sizeof(lastInput));
+	const char *saveDir = NULL;
+	if (environ_cb(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, &saveDir) && saveDir)
+		strlcpy(core.replay_dir, saveDir, sizeof(core.replay_dir));
+	else
+		strlcpy(core.replay_dir, ".", sizeof(core.replay_dir));
+
+	const Language language = detectLanguage(core.fs);
+	core.game = new Game(core.fs, "", 0, language);
+	core.indexed_output = false;
+	core.game->setPixelFormat(fmt == RETRO_PIXEL_FORMAT_RGB565);
+	core.game->init();
+	check_variables(true);
+	memset(&core.lastInput, 0, sizeof(core.lastInput));
+	if (log_cb)
+		log_cb(RETRO_LOG_INFO, "[RE]: Palette conversion: %s\n", palExpandName());
 
 	return true;
 }
@@ -219,15 +399,27 @@ bool retro_load_game_special(unsigned game_type,
 
 void retro_unload_game(void)
 {
-   if (game)
+   if (core.game && core.game->isRecording())
    {
-      delete game;
-      game = NULL;
+      char name[32];
+      File f;
+      snprintf(name, sizeof(name), "rs-replay-%u.rpl", (unsigned)time(0));
+      if (!f.open(name, "wb", core.replay_dir) || !core.game->stopRecording(&f))
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "[RE]: Unable to write replay '%s/%s'\n", core.replay_dir, name);
+      }
    }
-   if (fs)
+   if (core.game)
    {
-      delete fs;
-      fs = NULL;
+      delete core.game;
+      core.game = NULL;
+      core.indexed_output = false;
+   }
+   if (core.fs)
+   {
+      delete core.fs;
+      core.fs = NULL;
    }
 }
 
@@ -246,7 +438,13 @@ void *retro_get_memory_data(unsigned id)
    switch (id)
    {
       case RETRO_MEMORY_VIDEO_RAM:
-         return game->getFrameBuffer();
+         return core.game->getFrameBuffer();
+      case RE_MEMORY_INDEXED_FRAME:
+         return core.indexed_output ? (void *)core.game->getIndexedFrame() : NULL;
+      case RE_MEMORY_PALETTE:
+         return core.indexed_output ? (void *)core.game->getPalette() : NULL;
+      case RE_MEMORY_PALETTE_GEN:
+         return core.indexed_output ? &core.game->_vid._paletteGen : NULL;
       case RETRO_MEMORY_SYSTEM_RAM:
       default:
          break;
@@ -262,7 +460,13 @@ size_t retro_get_memory_size(unsigned id)
       case RETRO_MEMORY_SYSTEM_RAM:
          return 128;
       case RETRO_MEMORY_VIDEO_RAM:
-         return Video::GAMESCREEN_SIZE * sizeof(uint32_t);
+         return core.game ? core.game->getFrameBufferSize() : 0;
+      case RE_MEMORY_INDEXED_FRAME:
+         return core.indexed_output ? Video::GAMESCREEN_SIZE : 0;
+      case RE_MEMORY_PALETTE:
+         return core.indexed_output ? 256 * sizeof(uint32_t) : 0;
+      case RE_MEMORY_PALETTE_GEN:
+         return core.indexed_output ? sizeof(uint32_t) : 0;
       default:
          break;
    }
@@ -284,16 +488,33 @@ void retro_init(void)
 
 	if (environ_cb(RETRO_ENVIRONMENT_GET_INPUT_BITMASKS, NULL))
 		libretro_supports_bitmasks = true;
+
+	if (!environ_cb(RETRO_ENVIRONMENT_GET_CAN_DUPE, &libretro_can_dupe))
+		libretro_can_dupe = false;
+
+	if (!environ_cb(RETRO_ENVIRONMENT_GET_PERF_INTERFACE, &perf_cb))
+		memset(&perf_cb, 0, sizeof(perf_cb));
+
+	/* the converter is shared by every Game, pick it once */
+	palExpandInit();
 }
 
 void retro_deinit(void)
 {
+	free(core.audio_mono);
+	free(core.audio_stereo);
+	core.audio_mono     = NULL;
+	core.audio_stereo   = NULL;
+	core.audio_capacity = 0;
+
 	libretro_supports_bitmasks = false;
+	libretro_can_dupe = false;
+	memset(&perf_cb, 0, sizeof(perf_cb));
 }
 
 void retro_reset(void)
 {
-	game->resetGameState();
+	core.game->resetGameState();
 }
 
 static void update_button(unsigned int id, bool &button, bool *old_val)
@@ -301,7 +522,7 @@ static void update_button(unsigned int id, bool &button, bool *old_val)
    bool new_val;
 
    if (libretro_supports_bitmasks)
-      new_val = joypad_bits & (1 << id) ? 1 : 0;
+      new_val = core.joypad_bits & (1 << id) ? 1 : 0;
    else
       new_val = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, id) != 0;
 
@@ -334,60 +555,111 @@ static void update_input(void)
 
    input_poll_cb();
 
-   PlayerInput &pi = game->_pi;
+   PlayerInput &pi = core.game->_pi;
 
    pi.dirMask = 0;
 
    if (libretro_supports_bitmasks)
-      joypad_bits = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_MASK);
+      core.joypad_bits = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_MASK);
    else
    {
-      joypad_bits = 0;
+      core.joypad_bits = 0;
       for (i = 0; i < (RETRO_DEVICE_ID_JOYPAD_R3+1); i++)
-         joypad_bits |= input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, i) ? (1 << i) : 0;
+         core.joypad_bits |= input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, i) ? (1 << i) : 0;
    }
 
    for (i = 0; i < ARRAY_SIZE(joy_map); i++)
-      pi.dirMask |= joypad_bits & (1 << joy_map[i].retro) ? joy_map[i].player : 0;
+      pi.dirMask |= core.joypad_bits & (1 << joy_map[i].retro) ? joy_map[i].player : 0;
 
    update_button(RETRO_DEVICE_ID_JOYPAD_X, pi.action, NULL);
    update_button(RETRO_DEVICE_ID_JOYPAD_B, pi.weapon, NULL);
-   update_button(RETRO_DEVICE_ID_JOYPAD_A, pi.use, &lastInput.use);
+   update_button(RETRO_DEVICE_ID_JOYPAD_A, pi.use, &core.lastInput.use);
    update_button(RETRO_DEVICE_ID_JOYPAD_Y, pi.inventory_skip,
-         &lastInput.inventory_skip);
+         &core.lastInput.inventory_skip);
+}
+
+static void mono_to_stereo(int16_t *dst, const int16_t *src, unsigned count)
+{
+   unsigned i = 0;
+#if defined(__SSE2__)
+   for (; i + 8 <= count; i += 8)
+   {
+      const __m128i m = _mm_loadu_si128((const __m128i *)(src + i));
+      _mm_storeu_si128((__m128i *)(dst + i * 2),     _mm_unpacklo_epi16(m, m));
+      _mm_storeu_si128((__m128i *)(dst + i * 2 + 8), _mm_unpackhi_epi16(m, m));
+   }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+   for (; i + 8 <= count; i += 8)
+   {
+      int16x8x2_t lr;
+      lr.val[0] = vld1q_s16(src + i);
+      lr.val[1] = lr.val[0];
+      vst2q_s16(dst + i * 2, lr);
+   }
+#endif
+   for (; i < count; i++)
+   {
+      dst[i * 2]     = src[i];
+      dst[i * 2 + 1] = src[i];
+   }
+}
+
+/* Mixes the samples of the frame just run (the count varies by one from
+ * frame to frame when the rate is not a multiple of the frame rate) and
+ * hands them to the frontend as interleaved stereo. */
+static void audio_stage_run(void)
+{
+   const unsigned count = core.game->getFrameSamples();
+
+   if (count > core.audio_capacity)
+   {
+      int16_t *mono   = (int16_t *)realloc(core.audio_mono, count * sizeof(int16_t));
+      int16_t *stereo = (int16_t *)realloc(core.audio_stereo, count * 2 * sizeof(int16_t));
+      if (mono)
+         core.audio_mono = mono;
+      if (stereo)
+         core.audio_stereo = stereo;
+      if (!mono || !stereo)
+         return;
+      core.audio_capacity = count;
+   }
+
+   core.game->processFragment(core.audio_mono, count);
+   mono_to_stereo(core.audio_stereo, core.audio_mono, count);
+   audio_batch_cb(core.audio_stereo, count);
 }
 
 void retro_run(void)
 {
-   unsigned i;
-   static int16_t sampleBuffer[2048];
-   static int16_t stereoBuffer[2048];
-   /* Get the number of samples in a frame */
-   uint16_t samplesPerFrame = game->getOutputSampleRate()
-      / game->getFrameRate();
+   bool updated = false;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
+      check_variables(false);
 
    //INPUT
    update_input();
 
    //EMULATE
-   game->runFrame();
+   /* rewinding loads the state pushed last and runs that frame again
+    * without pushing it back; a replay recording goes on in a new segment */
+   if (core.rewind_budget && (core.joypad_bits & (1 << RETRO_DEVICE_ID_JOYPAD_L2)))
+      core.game->rewindStep();
+   else
+      core.game->rewindPush();
+   core.game->runFrame();
 
    //VIDEO
-   video_cb(game->getFrameBuffer(),
-         Video::GAMESCREEN_W, Video::GAMESCREEN_H,
-         Video::GAMESCREEN_W * sizeof(uint32_t));
+   /* held pace frames leave the image untouched: report them as dupes;
+    * the indexed output leaves the framebuffer to the host */
+   if (!core.indexed_output && (core.game->consumeFrameDirty() || !libretro_can_dupe))
+      video_cb(core.game->getFrameBuffer(),
+            Video::GAMESCREEN_W, Video::GAMESCREEN_H,
+            core.game->getFrameBufferPitch());
+   else
+      video_cb(NULL,
+            Video::GAMESCREEN_W, Video::GAMESCREEN_H,
+            core.game->getFrameBufferPitch());
 
    //AUDIO
-   memset(sampleBuffer, 0, samplesPerFrame * sizeof(int16_t));
-   game->processFragment(sampleBuffer, samplesPerFrame);
-
-   int16_t        *p        = stereoBuffer;
-   for (i = 0; i < samplesPerFrame; i++)
-   {
-      p[0] = sampleBuffer[i];
-      p[1] = sampleBuffer[i];
-      p += 2;
-   }
-
-   audio_batch_cb((int16_t *) stereoBuffer, samplesPerFrame);
+   audio_stage_run();
 }
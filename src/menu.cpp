@@ -75,6 +75,7 @@ void Menu::loadPicture(const char *prefix) {
 			}
 		}
 	}
+	_vid->invalidateFrontLayer();
 	_res->load_PAL_menu(prefix, _res->_scratchBuffer);
 	_vid->setPalette(_res->_scratchBuffer, 256);
 }
@@ -298,7 +299,7 @@ void Menu::handleTitleScreen() {
 	menuItems[menuItemsCount].str = LocaleData::LI_07_START;
 	menuItems[menuItemsCount].opt = MENU_OPTION_ITEM_START;
 	++menuItemsCount;
-	if (g_options.enable_password_menu) {
+	if (_game->_options.enable_password_menu) {
 		menuItems[menuItemsCount].str = LocaleData::LI_08_SKILL;
 		menuItems[menuItemsCount].opt = MENU_OPTION_ITEM_SKILL;
 		++menuItemsCount;
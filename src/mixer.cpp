@@ -145,6 +145,8 @@ void Mixer::mix(int16_t *out, int len)
 			_premixHookData = 0;
 		}
 	}
+	else
+		memset(out, 0, len * sizeof(int16_t));
 	for (i = 0; i < NUM_CHANNELS; ++i)
    {
 		MixerChannel *ch = &_channels[i];
@@ -167,6 +169,36 @@ void Mixer::mix(int16_t *out, int len)
 	}
 }
 
+/* Advances the sound channels by len samples exactly as mix() would,
+ * without producing any output. The premix hook (music, SEQ audio) is not
+ * run: the game logic only ever looks at the channels, through play() and
+ * isPlaying(). */
+void Mixer::skip(int len)
+{
+   unsigned i;
+   for (i = 0; i < NUM_CHANNELS; ++i)
+   {
+      MixerChannel *ch = &_channels[i];
+      if (ch->active)
+      {
+         /* first step at which mix() finds the chunk exhausted */
+         const uint64_t limit = (uint64_t)(ch->chunk.len - 1) << FRAC_BITS;
+         uint64_t steps = len;
+         if (ch->chunkPos >= limit)
+            steps = 0;
+         else if (ch->chunkInc != 0)
+         {
+            const uint64_t left = (limit - ch->chunkPos + ch->chunkInc - 1) / ch->chunkInc;
+            if (left < steps)
+               steps = left;
+         }
+         if (steps < (uint64_t)len)
+            ch->active = false;
+         ch->chunkPos += (uint32_t)steps * ch->chunkInc;
+      }
+   }
+}
+
 void Mixer::mixCallback(void *param, int16_t *buf, int len)
 {
 	((Mixer *)param)->mix(buf, len);
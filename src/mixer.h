@@ -41,6 +41,8 @@ struct FileSystem;
 struct Game;
 
 struct Mixer {
+	/* Premix hooks write all len samples (zeroes where silent), so mix()
+	 * only has to clear the buffer when there is none */
 	typedef bool (*PremixHook)(void *userData, int16_t *buf, int len);
 
 	enum MusicType {
@@ -75,6 +77,7 @@ struct Mixer {
 	void playMusic(int num);
 	void stopMusic();
 	void mix(int16_t *buf, int len);
+	void skip(int len);
 
 	static void mixCallback(void *param, int16_t *buf, int len);
 };
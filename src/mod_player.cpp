@@ -10,6 +10,28 @@
 
 #ifdef USE_MODPLUG
 #include <modplug.h>
+#ifdef HAVE_STD_THREADS
+#include <mutex>
+#endif
+
+/* libmodplug keeps its mixer settings and DSP state in globals. Players
+ * from different Game instances take turns, each making its own settings
+ * current before loading or mixing. */
+#ifdef HAVE_STD_THREADS
+static std::mutex _modplugMutex;
+#define MODPLUG_LOCK() std::lock_guard<std::mutex> modplugLock(_modplugMutex)
+#else
+#define MODPLUG_LOCK()
+#endif
+
+static ModPlug_Settings _modplugSettings;
+
+static void applySettings(ModPlug_Settings *settings) {
+	if (memcmp(&_modplugSettings, settings, sizeof(ModPlug_Settings)) != 0) {
+		ModPlug_SetSettings(settings);
+		_modplugSettings = *settings;
+	}
+}
 
 struct ModPlayer_impl {
 
@@ -22,6 +44,7 @@ struct ModPlayer_impl {
 	}
 
 	void init(const int rate) {
+		MODPLUG_LOCK();
 		memset(&_settings, 0, sizeof(_settings));
 		ModPlug_GetSettings(&_settings);
 		_settings.mFlags = MODPLUG_ENABLE_OVERSAMPLING | MODPLUG_ENABLE_NOISE_REDUCTION;
@@ -30,21 +53,33 @@ struct ModPlayer_impl {
 		_settings.mFrequency = rate;
 		_settings.mResamplingMode = MODPLUG_RESAMPLE_FIR;
 		_settings.mLoopCount = -1;
-		ModPlug_SetSettings(&_settings);
+		applySettings(&_settings);
 	}
 
 	bool load(File *f) {
 		const uint32_t size = f->size();
-		uint8_t *data = (uint8_t *)malloc(size);
+		/* the module is copied by ModPlug_Load, the data is released after */
+		uint8_t *mapping = f->detachMapping();
+		uint8_t *data = mapping ? mapping : (uint8_t *)malloc(size);
 		if (data) {
-			f->read(data, size);
+			if (!mapping) {
+				f->read(data, size);
+			}
+			MODPLUG_LOCK();
+			applySettings(&_settings);
 			_mf = ModPlug_Load(data, size);
 		}
+		if (mapping) {
+			File::unmap(mapping, size);
+		} else {
+			free(data);
+		}
 		return _mf != 0;
 	}
 
 	void unload() {
 		if (_mf) {
+			MODPLUG_LOCK();
 			ModPlug_Unload(_mf);
 			_mf = 0;
 		}
@@ -52,12 +87,17 @@ struct ModPlayer_impl {
 
 	bool mix(int16_t *buf, int len) {
 		if (_mf) {
+			MODPLUG_LOCK();
+			applySettings(&_settings);
 			const int order = ModPlug_GetCurrentOrder(_mf);
 			if (order == 3 && _repeatIntro) {
 				ModPlug_SeekOrder(_mf, 1);
 				_repeatIntro = false;
 			}
 			const int count = ModPlug_Read(_mf, buf, len * sizeof(int16_t));
+			if (count < (int) (len * sizeof(int16_t))) {
+				memset((uint8_t *) buf + count, 0, len * sizeof(int16_t) - count);
+			}
 			// setting mLoopCount to non-zero does not trigger any looping in
 			// my test and ModPlug_Read returns 0.
 			// looking at the libmodplug-0.8.8 tarball, it seems the variable
@@ -68,6 +108,7 @@ struct ModPlayer_impl {
 			}
 			return true;
 		}
+		memset(buf, 0, len * sizeof(int16_t));
 		return false;
 	}
 };
@@ -652,7 +693,7 @@ void ModPlayer::play(int num) {
 	if (num < _modulesFilesCount) {
 		File f;
 		for (uint8_t i = 0; i < ARRAY_SIZE(_modulesFiles[num]); ++i) {
-			if (f.open(_modulesFiles[num][i], "rb", _fs)) {
+			if (f.open(_modulesFiles[num][i], "mrb", _fs)) {
 				_impl->init(_mix->getSampleRate());
 				if (_impl->load(&f)) {
 					_impl->_repeatIntro = (num == 0) && !_isAmiga;
@@ -0,0 +1,204 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "palconv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PALCONV_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PALCONV_NEON
+#include <arm_neon.h>
+#endif
+
+void palSplit(PalPlanes *planes, const uint32_t *pal32, const uint16_t *pal16) {
+	const uint8_t *p = (const uint8_t *)pal32;
+	for (int i = 0; i < 256; ++i, p += 4) {
+		planes->p32[0][i] = p[0];
+		planes->p32[1][i] = p[1];
+		planes->p32[2][i] = p[2];
+		planes->p32[3][i] = p[3];
+	}
+	p = (const uint8_t *)pal16;
+	for (int i = 0; i < 256; ++i, p += 2) {
+		planes->p16[0][i] = p[0];
+		planes->p16[1][i] = p[1];
+	}
+}
+
+static void palExpand32_scalar(uint32_t *dst, const uint8_t *src, int n, const uint32_t *pal, const PalPlanes *) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		dst[i + 0] = pal[src[i + 0]];
+		dst[i + 1] = pal[src[i + 1]];
+		dst[i + 2] = pal[src[i + 2]];
+		dst[i + 3] = pal[src[i + 3]];
+	}
+	for (; i < n; ++i) {
+		dst[i] = pal[src[i]];
+	}
+}
+
+#ifdef PALCONV_AVX2
+/* SSE2 has no gather and the 1 KiB table is far too large for byte
+ * shuffles, so AVX2 is the first level where the lookup vectorizes. */
+__attribute__((target("avx2")))
+static void palExpand32_avx2(uint32_t *dst, const uint8_t *src, int n, const uint32_t *pal, const PalPlanes *) {
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i idx = _mm_loadu_si128((const __m128i *)(src + i));
+		const __m256i lo = _mm256_cvtepu8_epi32(idx);
+		const __m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8));
+		_mm256_storeu_si256((__m256i *)(dst + i),     _mm256_i32gather_epi32((const int *)pal, lo, 4));
+		_mm256_storeu_si256((__m256i *)(dst + i + 8), _mm256_i32gather_epi32((const int *)pal, hi, 4));
+	}
+	for (; i < n; ++i) {
+		dst[i] = pal[src[i]];
+	}
+}
+#endif
+
+#ifdef PALCONV_NEON
+#ifdef __aarch64__
+/* TBL looks 16 indices up in at most 64 bytes, so a 256 byte plane is four
+ * tables. TBX leaves the lanes whose index is out of range alone: taking 64
+ * off the indices before each table lets every lane land in exactly one. */
+typedef uint8x16_t   PalVec;
+typedef uint8x16x2_t PalVec2;
+typedef uint8x16x4_t PalVec4;
+enum { PAL_STEP = 16, PAL_TABLES = 4 };
+
+static inline PalVec palLoad(const uint8_t *p) {
+	return vld1q_u8(p);
+}
+
+static inline PalVec palLookup(const PalVec4 *t, PalVec idx) {
+	const PalVec range = vdupq_n_u8(64);
+	PalVec r = vqtbl4q_u8(t[0], idx);
+	for (int i = 1; i < PAL_TABLES; ++i) {
+		idx = vsubq_u8(idx, range);
+		r = vqtbx4q_u8(r, t[i], idx);
+	}
+	return r;
+}
+
+static inline void palStore(uint8_t *dst, const PalVec2 &v) {
+	vst2q_u8(dst, v);
+}
+
+static inline void palStore(uint8_t *dst, const PalVec4 &v) {
+	vst4q_u8(dst, v);
+}
+#else
+/* ARMv7 VTBL looks 8 indices up in at most 32 bytes, eight tables a plane */
+typedef uint8x8_t   PalVec;
+typedef uint8x8x2_t PalVec2;
+typedef uint8x8x4_t PalVec4;
+enum { PAL_STEP = 8, PAL_TABLES = 8 };
+
+static inline PalVec palLoad(const uint8_t *p) {
+	return vld1_u8(p);
+}
+
+static inline PalVec palLookup(const PalVec4 *t, PalVec idx) {
+	const PalVec range = vdup_n_u8(32);
+	PalVec r = vtbl4_u8(t[0], idx);
+	for (int i = 1; i < PAL_TABLES; ++i) {
+		idx = vsub_u8(idx, range);
+		r = vtbx4_u8(r, t[i], idx);
+	}
+	return r;
+}
+
+static inline void palStore(uint8_t *dst, const PalVec2 &v) {
+	vst2_u8(dst, v);
+}
+
+static inline void palStore(uint8_t *dst, const PalVec4 &v) {
+	vst4_u8(dst, v);
+}
+#endif
+
+/* Looks each plane up for PAL_STEP pixels and stores the planes interleaved,
+ * returns the number of pixels done */
+template <typename V, int N>
+static int palExpandNeon(uint8_t *dst, const uint8_t *src, int n, const uint8_t (*planes)[256]) {
+	PalVec4 t[N][PAL_TABLES];
+	for (int k = 0; k < N; ++k) {
+		for (int i = 0; i < PAL_TABLES; ++i) {
+			for (int j = 0; j < 4; ++j) {
+				t[k][i].val[j] = palLoad(planes[k] + (i * 4 + j) * PAL_STEP);
+			}
+		}
+	}
+	int i = 0;
+	for (; i + PAL_STEP <= n; i += PAL_STEP) {
+		const PalVec idx = palLoad(src + i);
+		V px;
+		for (int k = 0; k < N; ++k) {
+			px.val[k] = palLookup(t[k], idx);
+		}
+		palStore(dst + i * N, px);
+	}
+	return i;
+}
+
+static void palExpand32_neon(uint32_t *dst, const uint8_t *src, int n, const uint32_t *pal, const PalPlanes *planes) {
+	int i = palExpandNeon<PalVec4, 4>((uint8_t *)dst, src, n, planes->p32);
+	for (; i < n; ++i) {
+		dst[i] = pal[src[i]];
+	}
+}
+#endif
+
+void palExpand16(uint16_t *dst, const uint8_t *src, int n, const uint16_t *pal, const PalPlanes *planes) {
+	int i = 0;
+#ifdef PALCONV_NEON
+	i = palExpandNeon<PalVec2, 2>((uint8_t *)dst, src, n, planes->p16);
+#endif
+	for (; i + 4 <= n; i += 4) {
+		dst[i + 0] = pal[src[i + 0]];
+		dst[i + 1] = pal[src[i + 1]];
+		dst[i + 2] = pal[src[i + 2]];
+		dst[i + 3] = pal[src[i + 3]];
+	}
+	for (; i < n; ++i) {
+		dst[i] = pal[src[i]];
+	}
+}
+
+#ifdef PALCONV_NEON
+PalExpand32Proc palExpand32 = palExpand32_neon;
+
+static const char *_palExpandName = "neon";
+#else
+PalExpand32Proc palExpand32 = palExpand32_scalar;
+
+static const char *_palExpandName = "scalar";
+#endif
+
+void palExpandInit() {
+#ifdef PALCONV_NEON
+	/* NEON is part of the target when the compiler defines __ARM_NEON */
+	palExpand32 = palExpand32_neon;
+	_palExpandName = "neon";
+#else
+	palExpand32 = palExpand32_scalar;
+	_palExpandName = "scalar";
+#endif
+#ifdef PALCONV_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		palExpand32 = palExpand32_avx2;
+		_palExpandName = "avx2";
+	}
+#endif
+}
+
+const char *palExpandName() {
+	return _palExpandName;
+}
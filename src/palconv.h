@@ -0,0 +1,37 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef PALCONV_H__
+#define PALCONV_H__
+
+#include "intern.h"
+
+/* The palettes split in byte planes for the table lookup kernels: plane k
+ * holds byte k of every entry as laid out in memory, so that the planes
+ * looked up for a run of pixels interleave back into its entries. The
+ * caller keeps them along with the palettes and calls palSplit() when an
+ * entry changes. */
+struct PalPlanes {
+	uint8_t p32[4][256];
+	uint8_t p16[2][256];
+};
+
+void palSplit(PalPlanes *planes, const uint32_t *pal32, const uint16_t *pal16);
+
+/* Palette expansion of indexed pixels, dst[i] = pal[src[i]] for i < n.
+ * This is the inner loop of every present (Video::copyRect), so the kernel
+ * is picked once at startup from what the host CPU supports. */
+typedef void (*PalExpand32Proc)(uint32_t *dst, const uint8_t *src, int n, const uint32_t *pal, const PalPlanes *planes);
+
+extern PalExpand32Proc palExpand32;
+
+/* RGB565 targets are the handheld/embedded ones, NEON is the only kernel
+ * worth having there and it is known at build time */
+void palExpand16(uint16_t *dst, const uint8_t *src, int n, const uint16_t *pal, const PalPlanes *planes);
+
+void palExpandInit();
+const char *palExpandName();
+
+#endif // PALCONV_H__
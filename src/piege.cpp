@@ -22,6 +22,7 @@ void Game::pge_resetGroups() {
 	le->next_entry = 0;
 	le->index = 0;
 	le->group_id = 0;
+	_stateHash.markDirty(StateHash::DIRTY_GROUPS);
 }
 
 void Game::pge_removeFromGroup(uint8_t idx) {
@@ -38,6 +39,7 @@ void Game::pge_removeFromGroup(uint8_t idx) {
 			le = cur;
 		}
 		_pge_nextFreeGroup = next;
+		_stateHash.markDirty(StateHash::DIRTY_GROUPS);
 	}
 }
 
@@ -1407,7 +1409,7 @@ int Game::pge_op_setCollisionState2(ObjectOpcodeArgs *args) {
 }
 
 int Game::pge_op_saveState(ObjectOpcodeArgs *args) {
-	_saveStateCompleted = true;
+	/* _saveStateCompleted is set once the file is written */
 	_validSaveState = saveGameState(0);
 	return 0xFFFF;
 }
@@ -1626,6 +1628,7 @@ int Game::pge_o_unk0x72(ObjectOpcodeArgs *args) {
 			--_cx;
 		} else {
 			memcpy(_di->unk2, _di->data_buf, _di->data_size + 1);
+			_stateHash.markDirty(StateHash::DIRTY_CT);
 			break;
 		}
 	}
@@ -2045,6 +2048,7 @@ int Game::pge_updateCollisionState(LivePGE *pge, int16_t pge_dy, uint8_t var8) {
 				assert(pge_unk1C < 0x70);
 				memset(grid_data, var8, pge_unk1C);
 				grid_data += pge_unk1C;
+				_stateHash.markDirty(StateHash::DIRTY_CT | StateHash::DIRTY_COLSLOTS2);
 				return 1;
 			} else {
 				++i;
@@ -2069,6 +2073,7 @@ int Game::pge_updateCollisionState(LivePGE *pge, int16_t pge_dy, uint8_t var8) {
 			++_col_slots2Cur;
 			slot1->next_slot = _col_slots2Next;
 			_col_slots2Next = slot1;
+			_stateHash.markDirty(StateHash::DIRTY_CT | StateHash::DIRTY_COLSLOTS2);
 		}
 	}
 	return 1;
@@ -2128,6 +2133,7 @@ void Game::pge_updateGroup(uint8_t idx, uint8_t unk1, int16_t unk2) {
 		le->next_entry = _ax;
 		le->index = idx;
 		le->group_id = unk2;
+		_stateHash.markDirty(StateHash::DIRTY_GROUPS);
 	}
 }
 
@@ -0,0 +1,96 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <algorithm>
+#include "profiler.h"
+
+Profiler::Profiler()
+	: _enabled(false), _dumpInterval(0), _frames(0), _getTimeUsec(0) {
+	reset();
+}
+
+/* Called on every core option update: the windows are only cleared when
+ * the profiler settings themselves change. */
+void Profiler::setup(retro_perf_get_time_usec_t getTimeUsec, int dumpInterval) {
+	const bool enabled = (getTimeUsec != 0 && dumpInterval > 0);
+	if (enabled == _enabled && dumpInterval == _dumpInterval && getTimeUsec == _getTimeUsec) {
+		return;
+	}
+	_getTimeUsec  = getTimeUsec;
+	_dumpInterval = dumpInterval;
+	_enabled      = enabled;
+	reset();
+}
+
+void Profiler::reset() {
+	for (int i = 0; i < PROF_NUM; ++i) {
+		_samples[i].next  = 0;
+		_samples[i].count = 0;
+	}
+	_frames = 0;
+}
+
+void Profiler::record(int stage, int32_t usec) {
+	Samples *s = &_samples[stage];
+	s->usec[s->next] = usec;
+	s->next = (s->next + 1) % WINDOW_SIZE;
+	if (s->count < WINDOW_SIZE) {
+		++s->count;
+	}
+}
+
+void Profiler::endFrame() {
+	if (!_enabled) {
+		return;
+	}
+	++_frames;
+	if (_dumpInterval > 0 && _frames >= _dumpInterval) {
+		dump();
+		_frames = 0;
+	}
+}
+
+int32_t Profiler::getPercentile(int stage, int p) const {
+	const Samples *s = &_samples[stage];
+	if (s->count == 0) {
+		return -1;
+	}
+	int32_t sorted[WINDOW_SIZE];
+	memcpy(sorted, s->usec, s->count * sizeof(int32_t));
+	const int n = (s->count - 1) * p / 100;
+	std::nth_element(sorted, sorted + n, sorted + s->count);
+	return sorted[n];
+}
+
+const char *Profiler::getStageName(int stage) {
+	static const char *names[] = {
+		"pge_getInput",
+		"pge_prepare",
+		"col_prepareRoomState",
+		"pge_process",
+		"prepareAnims",
+		"drawAnims",
+		"present",
+		"mixer",
+		"cutscene",
+		"frame"
+	};
+	return names[stage];
+}
+
+void Profiler::dump() {
+	if (!log_cb) {
+		return;
+	}
+	log_cb(RETRO_LOG_INFO, "[RE]: profile, last %d samples per stage (usec)\n", WINDOW_SIZE);
+	log_cb(RETRO_LOG_INFO, "[RE]: %-22s %6s %6s %6s %6s %6s\n", "stage", "count", "p50", "p90", "p99", "max");
+	for (int i = 0; i < PROF_NUM; ++i) {
+		if (_samples[i].count == 0) {
+			continue;
+		}
+		log_cb(RETRO_LOG_INFO, "[RE]: %-22s %6d %6d %6d %6d %6d\n", getStageName(i), _samples[i].count,
+			getPercentile(i, 50), getPercentile(i, 90), getPercentile(i, 99), getPercentile(i, 100));
+	}
+}
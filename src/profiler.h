@@ -0,0 +1,68 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef PROFILER_H__
+#define PROFILER_H__
+
+#include "intern.h"
+
+/* Opt-in frame profiler. Stages are timed with the frontend's microsecond
+ * clock and kept in a rolling window per stage; every _dumpInterval frames
+ * the percentiles of that window are written to the log. Disabled, begin()
+ * and end() reduce to a flag test. */
+struct Profiler {
+	enum Stage {
+		PROF_PGE_GETINPUT,
+		PROF_PGE_PREPARE,
+		PROF_COL_PREPARE,
+		PROF_PGE_PROCESS,
+		PROF_PREPARE_ANIMS,
+		PROF_DRAW_ANIMS,
+		PROF_PRESENT,
+		PROF_MIX,
+		PROF_CUTSCENE,
+		PROF_FRAME,
+		PROF_NUM
+	};
+
+	enum {
+		WINDOW_SIZE = 512
+	};
+
+	struct Samples {
+		int32_t usec[WINDOW_SIZE];
+		int     next;
+		int     count;
+	};
+
+	bool                       _enabled;
+	int                        _dumpInterval; /* frames between two reports, 0 for none */
+	int                        _frames;
+	retro_perf_get_time_usec_t _getTimeUsec;
+	Samples                    _samples[PROF_NUM];
+
+	Profiler();
+
+	void setup(retro_perf_get_time_usec_t getTimeUsec, int dumpInterval);
+	void reset();
+
+	retro_time_t begin() const {
+		return _enabled ? _getTimeUsec() : 0;
+	}
+	void end(int stage, retro_time_t start) {
+		if (_enabled) {
+			record(stage, (int32_t) (_getTimeUsec() - start));
+		}
+	}
+	void record(int stage, int32_t usec);
+	void endFrame();
+
+	/* p-th percentile (0..100) of the current window of a stage, -1 if empty */
+	int32_t getPercentile(int stage, int p) const;
+	static const char *getStageName(int stage);
+	void dump();
+};
+
+#endif // PROFILER_H__
@@ -0,0 +1,403 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "file.h"
+#include "game.h"
+#include "replay.h"
+
+static const uint32_t TAG_FBRP = 0x46425250;
+static const uint16_t REPLAY_VERSION = 4; /* segments, each from a snapshot */
+
+/* grows a malloc'ed array to hold at least count elements */
+static bool reserve(void **p, uint32_t *capacity, uint32_t count, uint32_t elemSize, uint32_t minCapacity) {
+	if (count <= *capacity) {
+		return true;
+	}
+	uint32_t n = *capacity ? *capacity : minCapacity;
+	while (n < count) {
+		n *= 2;
+	}
+	void *q = realloc(*p, (size_t)n * elemSize);
+	if (!q) {
+		return false;
+	}
+	*p = q;
+	*capacity = n;
+	return true;
+}
+
+Replay::Replay()
+	: _mode(MODE_OFF), _segmentPending(false), _inFrame(false), _segments(0), _segmentsCount(0), _segmentsCapacity(0), _runs(0), _runsCount(0), _runsCapacity(0),
+	  _hashes(0), _frames(0), _hashesCapacity(0), _segment(0), _frame(0), _run(0), _runPos(0), _mismatches(0), _firstMismatch(0) {
+}
+
+Replay::~Replay() {
+	free();
+}
+
+void Replay::free() {
+	for (uint32_t i = 0; i < _segmentsCount; ++i) {
+		::free(_segments[i].snapshot);
+	}
+	::free(_segments);
+	_segments = 0;
+	_segmentsCount = _segmentsCapacity = 0;
+	::free(_runs);
+	_runs = 0;
+	_runsCount = _runsCapacity = 0;
+	::free(_hashes);
+	_hashes = 0;
+	_frames = _hashesCapacity = 0;
+	_segmentPending = false;
+	_inFrame = false;
+	_mode = MODE_OFF;
+}
+
+void Replay::beginRecord() {
+	free();
+	_mode = MODE_RECORD;
+	_segmentPending = true;
+}
+
+bool Replay::addSegment(uint8_t *snapshot, uint32_t size, uint16_t frameRate, uint32_t sampleRate) {
+	if (_segmentsCount == 0 || _segments[_segmentsCount - 1].firstFrame != _frames) {
+		if (!reserve((void **)&_segments, &_segmentsCapacity, _segmentsCount + 1, sizeof(Segment), 16)) {
+			log_cb(RETRO_LOG_ERROR, "[RE]: Out of memory, replay recording stopped\n");
+			::free(snapshot);
+			free();
+			return false;
+		}
+		++_segmentsCount;
+	} else {
+		::free(_segments[_segmentsCount - 1].snapshot);
+	}
+	Segment *seg = &_segments[_segmentsCount - 1];
+	seg->frameRate = frameRate;
+	seg->sampleRate = sampleRate;
+	seg->snapshot = snapshot;
+	seg->snapshotSize = size;
+	seg->firstFrame = _frames;
+	seg->firstRun = _runsCount;
+	_segmentPending = false;
+	return true;
+}
+
+void Replay::recordInput(uint16_t mask) {
+	if (_runsCount > _segments[_segmentsCount - 1].firstRun) {
+		uint32_t &last = _runs[_runsCount - 1];
+		if ((last >> 16) == mask && (last & 0xFFFF) != 0xFFFF) {
+			++last;
+			return;
+		}
+	}
+	if (!reserve((void **)&_runs, &_runsCapacity, _runsCount + 1, sizeof(uint32_t), 1024)) {
+		log_cb(RETRO_LOG_ERROR, "[RE]: Out of memory, replay recording stopped\n");
+		free();
+		return;
+	}
+	_runs[_runsCount++] = (mask << 16) | 1;
+}
+
+void Replay::recordHash(uint32_t hash) {
+	if (!reserve((void **)&_hashes, &_hashesCapacity, _frames + 1, sizeof(uint32_t), 4096)) {
+		log_cb(RETRO_LOG_ERROR, "[RE]: Out of memory, replay recording stopped\n");
+		free();
+		return;
+	}
+	_hashes[_frames++] = hash;
+}
+
+bool Replay::write(File *f) {
+	f->writeUint32BE(TAG_FBRP);
+	f->writeUint16BE(REPLAY_VERSION);
+	f->writeUint16BE(0);
+	f->writeUint32BE(_segmentsCount);
+	for (uint32_t i = 0; i < _segmentsCount; ++i) {
+		const Segment *seg = &_segments[i];
+		const bool last = (i + 1 == _segmentsCount);
+		const uint32_t frames = (last ? _frames : seg[1].firstFrame) - seg->firstFrame;
+		const uint32_t runs = (last ? _runsCount : seg[1].firstRun) - seg->firstRun;
+		f->writeUint16BE(seg->frameRate);
+		f->writeUint16BE(0);
+		f->writeUint32BE(seg->sampleRate);
+		f->writeUint32BE(frames);
+		f->writeUint32BE(runs);
+		f->writeUint32BE(seg->snapshotSize);
+		f->write(seg->snapshot, seg->snapshotSize);
+		for (uint32_t j = 0; j < runs; ++j) {
+			f->writeUint32BE(_runs[seg->firstRun + j]);
+		}
+		for (uint32_t j = 0; j < frames; ++j) {
+			f->writeUint32BE(_hashes[seg->firstFrame + j]);
+		}
+	}
+	return !f->ioErr();
+}
+
+bool Replay::read(File *f) {
+	free();
+	if (f->readUint32BE() != TAG_FBRP) {
+		log_cb(RETRO_LOG_ERROR, "[RE]: Bad replay format\n");
+		return false;
+	}
+	if (f->readUint16BE() != REPLAY_VERSION) {
+		log_cb(RETRO_LOG_ERROR, "[RE]: Invalid replay version\n");
+		return false;
+	}
+	f->readUint16BE();
+	const uint32_t count = f->readUint32BE();
+	uint64_t pos = 12;
+	if (f->ioErr() || count == 0 || pos + count * (uint64_t)20 > f->size()) {
+		log_cb(RETRO_LOG_ERROR, "[RE]: Truncated replay\n");
+		return false;
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		const uint16_t frameRate = f->readUint16BE();
+		f->readUint16BE();
+		const uint32_t sampleRate = f->readUint32BE();
+		const uint32_t frames = f->readUint32BE();
+		const uint32_t runs = f->readUint32BE();
+		const uint32_t snapshotSize = f->readUint32BE();
+		pos += 20 + snapshotSize + (runs + (uint64_t)frames) * 4;
+		if (f->ioErr() || frameRate == 0 || sampleRate == 0 || snapshotSize == 0 || pos > f->size()) {
+			log_cb(RETRO_LOG_ERROR, "[RE]: Truncated replay\n");
+			free();
+			return false;
+		}
+		uint8_t *snapshot = (uint8_t *)malloc(snapshotSize);
+		if (!snapshot || !reserve((void **)&_segments, &_segmentsCapacity, _segmentsCount + 1, sizeof(Segment), 16) ||
+			!reserve((void **)&_runs, &_runsCapacity, _runsCount + runs, sizeof(uint32_t), 1024) ||
+			!reserve((void **)&_hashes, &_hashesCapacity, _frames + frames, sizeof(uint32_t), 4096)) {
+			::free(snapshot);
+			free();
+			return false;
+		}
+		Segment *seg = &_segments[_segmentsCount++];
+		seg->frameRate = frameRate;
+		seg->sampleRate = sampleRate;
+		seg->snapshot = snapshot;
+		seg->snapshotSize = snapshotSize;
+		seg->firstFrame = _frames;
+		seg->firstRun = _runsCount;
+		f->read(snapshot, snapshotSize);
+		uint32_t runFrames = 0;
+		for (uint32_t j = 0; j < runs; ++j) {
+			_runs[_runsCount] = f->readUint32BE();
+			runFrames += _runs[_runsCount++] & 0xFFFF;
+		}
+		for (uint32_t j = 0; j < frames; ++j) {
+			_hashes[_frames++] = f->readUint32BE();
+		}
+		/* the inputs of a segment cover exactly its frames */
+		if (f->ioErr() || runFrames != frames) {
+			log_cb(RETRO_LOG_ERROR, "[RE]: Corrupt replay\n");
+			free();
+			return false;
+		}
+	}
+	_segment = _frame = _run = _runPos = 0;
+	_mismatches = _firstMismatch = 0;
+	return true;
+}
+
+const Replay::Segment *Replay::nextSegment() {
+	const Segment *seg = 0;
+	while (_segment < _segmentsCount && _segments[_segment].firstFrame == _frame) {
+		seg = &_segments[_segment++];
+	}
+	if (seg) {
+		_run = seg->firstRun;
+		_runPos = 0;
+	}
+	return seg;
+}
+
+bool Replay::nextInput(uint16_t *mask) {
+	while (_run < _runsCount && _runPos == (_runs[_run] & 0xFFFF)) {
+		++_run;
+		_runPos = 0;
+	}
+	if (_run == _runsCount || _frame == _frames) {
+		return false;
+	}
+	*mask = _runs[_run] >> 16;
+	++_runPos;
+	return true;
+}
+
+void Replay::checkHash(uint32_t hash) {
+	if (_frame < _frames && _hashes[_frame] != hash) {
+		if (_mismatches == 0) {
+			_firstMismatch = _frame;
+		}
+		++_mismatches;
+	}
+	++_frame;
+}
+
+/* The input mask is the demo recordings' keymask (see inp_update), with
+ * escape and the debug flags above. */
+static uint16_t packInput(const PlayerInput &pi) {
+	uint16_t mask = pi.dirMask & 0xF;
+	if (pi.use) {
+		mask |= 0x10;
+	}
+	if (pi.weapon) {
+		mask |= 0x20;
+	}
+	if (pi.action) {
+		mask |= 0x40;
+	}
+	if (pi.inventory_skip) {
+		mask |= 0x80;
+	}
+	if (pi.escape) {
+		mask |= 0x100;
+	}
+	mask |= (pi.dbgMask & 7) << 12;
+	return mask;
+}
+
+static void unpackInput(PlayerInput &pi, uint16_t mask) {
+	pi.dirMask        = mask & 0xF;
+	pi.use            = (mask & 0x10) != 0;
+	pi.weapon         = (mask & 0x20) != 0;
+	pi.action         = (mask & 0x40) != 0;
+	pi.inventory_skip = (mask & 0x80) != 0;
+	pi.escape         = (mask & 0x100) != 0;
+	pi.dbgMask        = (mask >> 12) & 7;
+}
+
+void Game::setInputMask(uint16_t mask) {
+	unpackInput(_pi, mask);
+}
+
+/* Snapshots the state the next frame starts from as a new segment */
+bool Game::replayStartSegment() {
+	const size_t size = getSnapshotSize();
+	uint8_t *snapshot = (uint8_t *)malloc(size);
+	const size_t len = snapshot ? saveSnapshot(snapshot, size) : 0;
+	if (len == 0) {
+		log_cb(RETRO_LOG_WARN, "[RE]: Unable to snapshot the game, replay recording stopped\n");
+		free(snapshot);
+		_replay.free();
+		return false;
+	}
+	uint8_t *p = (uint8_t *)realloc(snapshot, len);
+	return _replay.addSegment(p ? p : snapshot, len, _frameRate, getOutputSampleRate());
+}
+
+/* Restores the state and the rates a segment was recorded from */
+bool Game::replayLoadSegment(const Replay::Segment *seg) {
+	setOutputSampleRate(seg->sampleRate);
+	setFrameRate(seg->frameRate);
+	/* not a load of the player's, the playback goes on */
+	_replay._mode = Replay::MODE_OFF;
+	const int ret = loadSnapshot(seg->snapshot, seg->snapshotSize);
+	_replay._mode = Replay::MODE_VERIFY;
+	if (ret != SNAPSHOT_OK) {
+		log_cb(RETRO_LOG_ERROR, "[RE]: Unable to restore the replay snapshot at frame %u\n", _replay._frame);
+		++_replay._mismatches;
+		_replay._mode = Replay::MODE_OFF;
+		return false;
+	}
+	return true;
+}
+
+bool Game::startRecording() {
+	_replay.beginRecord();
+	return replayStartSegment();
+}
+
+bool Game::stopRecording(File *f) {
+	bool ret = false;
+	if (isRecording()) {
+		ret = !f || _replay.write(f);
+		if (f) {
+			log_cb(RETRO_LOG_INFO, "[RE]: Recorded %u frames of replay in %u segments\n", _replay._frames, _replay._segmentsCount);
+		}
+	}
+	_replay.free();
+	return ret;
+}
+
+bool Game::startReplay(File *f) {
+	if (!_replay.read(f)) {
+		return false;
+	}
+	_replay._mode = Replay::MODE_VERIFY;
+	if (!replayLoadSegment(_replay.nextSegment())) {
+		_replay.free();
+		return false;
+	}
+	return true;
+}
+
+/* A loaded state does not follow from the frames recorded so far, the
+ * recording goes on in a new segment from the next frame. During playback
+ * a load made by the game itself within a frame (continuing from the
+ * checkpoint) is replayed and checked by the hashes like the rest of the
+ * frame, any other load is reported as not matching. */
+void Game::replayStateLoaded() {
+	if (_replay._mode == Replay::MODE_RECORD) {
+		_replay._segmentPending = true;
+	} else if (_replay._mode == Replay::MODE_VERIFY && !_replay._inFrame) {
+		log_cb(RETRO_LOG_WARN, "[RE]: State loaded, replay stopped at frame %u\n", _replay._frame);
+		++_replay._mismatches;
+		_replay._mode = Replay::MODE_OFF;
+	}
+}
+
+void Game::replayBeginFrame() {
+	if (_replay._mode == Replay::MODE_RECORD) {
+		if (_replay._segmentPending && !replayStartSegment()) {
+			return;
+		}
+		_replay.recordInput(packInput(_pi));
+		return;
+	}
+	if (_replay._mode != Replay::MODE_VERIFY) {
+		return;
+	}
+	const Replay::Segment *seg = _replay.nextSegment();
+	if (seg && !replayLoadSegment(seg)) {
+		return;
+	}
+	uint16_t mask;
+	if (!_replay.nextInput(&mask)) {
+		finishReplay();
+		return;
+	}
+	unpackInput(_pi, mask);
+	_replay._inFrame = true;
+}
+
+void Game::replayEndFrame() {
+	if (_replay._mode == Replay::MODE_RECORD) {
+		_replay.recordHash(getStateHash());
+		return;
+	}
+	if (_replay._mode != Replay::MODE_VERIFY) {
+		return;
+	}
+	_replay._inFrame = false;
+	_replay.checkHash(getStateHash());
+	if (_replay._frame == _replay._frames) {
+		finishReplay();
+	}
+}
+
+void Game::finishReplay() {
+	if (_replay._frame != _replay._frames) {
+		log_cb(RETRO_LOG_WARN, "[RE]: Replay inputs end at frame %u of %u\n", _replay._frame, _replay._frames);
+		++_replay._mismatches;
+	} else if (_replay._mismatches == 0) {
+		log_cb(RETRO_LOG_INFO, "[RE]: Replay verified, %u frames\n", _replay._frame);
+	} else {
+		log_cb(RETRO_LOG_WARN, "[RE]: Replay desync at frame %u, %u of %u frames differ\n",
+			_replay._firstMismatch, _replay._mismatches, _replay._frame);
+	}
+	_replay._mode = Replay::MODE_OFF;
+}
@@ -0,0 +1,87 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef REPLAY_H__
+#define REPLAY_H__
+
+#include "intern.h"
+
+struct File;
+
+/* Input log of a run: the player input of each runFrame() as runs of
+ * identical masks, and the state hash after each frame. Replaying the
+ * inputs from the same state must give the same hashes.
+ *
+ * The run is cut in segments wherever it does not follow from the previous
+ * frame, that is after a state load (rewind, run-ahead, netplay, save
+ * slots) or a change of frame or output sample rate. Each segment starts
+ * from a snapshot (Game::saveSnapshot, portable across builds) taken before
+ * its first frame and records the rates the frames ran at: the sample rate
+ * sets the samples mixed each frame, which the story texts wait on.
+ *
+ * File layout, big-endian:
+ *
+ *   uint32_t 'FBRP' | uint16_t version | uint16_t 0 | uint32_t segments
+ *   segments:
+ *     uint16_t frame rate | uint16_t 0 | uint32_t output sample rate
+ *     uint32_t frames | uint32_t input runs | uint32_t snapshot size
+ *     snapshot | runs (uint16_t mask, uint16_t count) | hashes (uint32_t) */
+struct Replay {
+	enum {
+		MODE_OFF,
+		MODE_RECORD,
+		MODE_VERIFY
+	};
+
+	struct Segment {
+		uint16_t frameRate;
+		uint32_t sampleRate;
+		uint8_t  *snapshot;
+		uint32_t snapshotSize;
+		uint32_t firstFrame; /* in _hashes */
+		uint32_t firstRun;   /* in _runs */
+	};
+
+	int      _mode;
+	bool     _segmentPending; /* the next recorded frame starts a segment */
+	bool     _inFrame; /* a frame is being played back */
+	Segment  *_segments;
+	uint32_t _segmentsCount;
+	uint32_t _segmentsCapacity;
+	uint32_t *_runs; /* mask << 16 | count */
+	uint32_t _runsCount;
+	uint32_t _runsCapacity;
+	uint32_t *_hashes;
+	uint32_t _frames;
+	uint32_t _hashesCapacity;
+	/* playback position */
+	uint32_t _segment;
+	uint32_t _frame;
+	uint32_t _run;
+	uint32_t _runPos;
+	uint32_t _mismatches;
+	uint32_t _firstMismatch;
+
+	Replay();
+	~Replay();
+
+	void free();
+	void beginRecord();
+	/* takes snapshot, malloc'ed; replaces the last segment if no frame was
+	 * recorded in it */
+	bool addSegment(uint8_t *snapshot, uint32_t size, uint16_t frameRate, uint32_t sampleRate);
+	void recordInput(uint16_t mask);
+	void recordHash(uint32_t hash);
+	bool write(File *f);
+
+	bool read(File *f);
+	/* the segment the next frame plays in, NULL if it continues the last */
+	const Segment *nextSegment();
+	/* false once all the frames have been played back */
+	bool nextInput(uint16_t *mask);
+	void checkHash(uint32_t hash);
+};
+
+#endif // REPLAY_H__
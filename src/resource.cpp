@@ -29,10 +29,17 @@ Resource::Resource(FileSystem *fs, Language lang) {
 	}
 	_bankDataTail = _bankData + kBankDataSize;
 	clearBankData();
+	_levelResNum = -1;
 }
 
 Resource::~Resource() {
 	clearLevelRes();
+	for (int i = 0; i < NUM_CACHED_LEVELS; ++i) {
+		if (_levelCache[i]) {
+			freeLevelRes(_levelCache[i]);
+			_levelCache[i] = 0;
+		}
+	}
 	free(_fnt);
 	free(_icn); _icn = 0;
 	_icnLen = 0;
@@ -40,8 +47,8 @@ Resource::~Resource() {
 	free(_spc);
 	free(_spr1);
 	free(_scratchBuffer);
-	free(_cmd);
-	free(_pol);
+	freeData(_cmd);
+	freeData(_pol);
 	free(_cine_off);
 	free(_cine_txt);
 	for (int i = 0; i < _numSfx; ++i) {
@@ -50,6 +57,7 @@ Resource::~Resource() {
 	free(_sfxList);
 	free(_bankData);
 	delete _aba;
+	assert(_mappedCount == 0);
 }
 
 void Resource::init() {
@@ -64,16 +72,246 @@ void Resource::fini() {
 }
 
 void Resource::clearLevelRes() {
-	free(_tbn); _tbn = 0;
-	free(_mbk); _mbk = 0;
-	free(_pal); _pal = 0;
-	free(_map); _map = 0;
-	free(_lev); _lev = 0;
+	if (_levelResNum >= 0) {
+		/* owned by the cache entry */
+		dropLevelRes();
+		_levelResNum = -1;
+		trimLevelCache();
+	} else {
+		free(_tbn); _tbn = 0;
+		freeData(_mbk); _mbk = 0;
+		free(_pal); _pal = 0;
+		freeData(_map); _map = 0;
+		freeData(_lev); _lev = 0;
+		freeData(_sgd); _sgd = 0;
+		freeData(_bnq); _bnq = 0;
+		free(_ani); _ani = 0;
+		free_OBJ();
+	}
 	_levNum = -1;
-	free(_sgd); _sgd = 0;
-	free(_bnq); _bnq = 0;
-	free(_ani); _ani = 0;
-	free_OBJ();
+	_levelResSize = 0;
+}
+
+void Resource::setLevelCacheBudget(uint32_t bytes) {
+	_levelCacheBudget = bytes;
+	trimLevelCache();
+}
+
+void Resource::dropLevelRes() {
+	_tbn = _mbk = _pal = _map = _lev = _sgd = _bnq = _ani = 0;
+	memset(_objectNodesMap, 0, sizeof(_objectNodesMap));
+}
+
+static LevelRes *allocLevelRes(Resource *res, int level) {
+	LevelRes *lr = (LevelRes *)malloc(sizeof(LevelRes));
+	if (!lr) {
+		return 0;
+	}
+	lr->level = level;
+	lr->lastUse = 0;
+	lr->size = res->_levelResSize + sizeof(LevelRes);
+	lr->mbk = res->_mbk;
+	lr->pal = res->_pal;
+	lr->map = res->_map;
+	lr->lev = res->_lev;
+	lr->sgd = res->_sgd;
+	lr->bnq = res->_bnq;
+	lr->ani = res->_ani;
+	lr->tbn = res->_tbn;
+	lr->levNum = res->_levNum;
+	lr->numObjectNodes = res->_numObjectNodes;
+	memcpy(lr->objectNodesMap, res->_objectNodesMap, sizeof(res->_objectNodesMap));
+	lr->pgeNum = res->_pgeNum;
+	memcpy(lr->pgeInit, res->_pgeInit, sizeof(res->_pgeInit));
+	memcpy(lr->rp, res->_rp, sizeof(res->_rp));
+	memcpy(lr->ctData, res->_ctData, sizeof(res->_ctData));
+	return lr;
+}
+
+void Resource::cacheLevelRes(int level) {
+	if (_levelCacheBudget == 0) {
+		return;
+	}
+	LevelRes *lr = allocLevelRes(this, level);
+	if (!lr) {
+		return;
+	}
+	insertLevelRes(lr);
+	_levelResNum = level;
+	trimLevelCache();
+}
+
+void Resource::insertLevelRes(LevelRes *lr) {
+	int slot = -1;
+	for (int i = 0; i < NUM_CACHED_LEVELS; ++i) {
+		if (!_levelCache[i]) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot < 0) {
+		/* all taken, replace the least recently used */
+		slot = 0;
+		for (int i = 1; i < NUM_CACHED_LEVELS; ++i) {
+			if (_levelCache[i]->lastUse < _levelCache[slot]->lastUse) {
+				slot = i;
+			}
+		}
+		freeLevelRes(_levelCache[slot]);
+		_levelCache[slot] = 0;
+	}
+	lr->lastUse = ++_levelCacheTick;
+	_levelCache[slot] = lr;
+}
+
+void Resource::useLevelRes(const LevelRes *lr) {
+	_mbk = lr->mbk;
+	_pal = lr->pal;
+	_map = lr->map;
+	_lev = lr->lev;
+	_sgd = lr->sgd;
+	_bnq = lr->bnq;
+	_ani = lr->ani;
+	_tbn = lr->tbn;
+	_levNum = lr->levNum;
+	_numObjectNodes = lr->numObjectNodes;
+	memcpy(_objectNodesMap, lr->objectNodesMap, sizeof(_objectNodesMap));
+	_pgeNum = lr->pgeNum;
+	memcpy(_pgeInit, lr->pgeInit, sizeof(_pgeInit));
+	memcpy(_rp, lr->rp, sizeof(_rp));
+	memcpy(_ctData, lr->ctData, sizeof(_ctData));
+}
+
+bool Resource::loadCachedLevelRes(int level) {
+	assert(_levelResNum < 0);
+	for (int i = 0; i < NUM_CACHED_LEVELS; ++i) {
+		LevelRes *lr = _levelCache[i];
+		if (lr && lr->level == level) {
+			lr->lastUse = ++_levelCacheTick;
+			useLevelRes(lr);
+			_levelResNum = level;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Resource::isLevelResCached(int level) const {
+	for (int i = 0; i < NUM_CACHED_LEVELS; ++i) {
+		if (_levelCache[i] && _levelCache[i]->level == level) {
+			return true;
+		}
+	}
+	return false;
+}
+
+LevelRes *Resource::detachLevelRes(int level, MappedData *mapped, int *mappedCount) {
+	*mappedCount = 0;
+	LevelRes *lr = allocLevelRes(this, level);
+	if (!lr) {
+		return 0;
+	}
+	uint8_t *buffers[] = { lr->mbk, lr->map, lr->lev, lr->sgd, lr->bnq };
+	for (int i = 0; i < _mappedCount; ) {
+		bool found = false;
+		for (unsigned j = 0; j < ARRAY_SIZE(buffers); ++j) {
+			if (buffers[j] && _mapped[i].ptr == buffers[j]) {
+				found = true;
+				break;
+			}
+		}
+		if (found) {
+			mapped[(*mappedCount)++] = _mapped[i];
+			_mapped[i] = _mapped[--_mappedCount];
+		} else {
+			++i;
+		}
+	}
+	dropLevelRes();
+	_levNum = -1;
+	_levelResSize = 0;
+	return lr;
+}
+
+void Resource::adoptLevelRes(LevelRes *lr, const MappedData *mapped, int mappedCount) {
+	assert(_levelResNum < 0);
+	for (int i = 0; i < mappedCount; ++i) {
+		assert(_mappedCount < MAX_MAPPED_DATA);
+		_mapped[_mappedCount++] = mapped[i];
+	}
+	useLevelRes(lr);
+	if (_levelCacheBudget != 0) {
+		insertLevelRes(lr);
+		_levelResNum = lr->level;
+		trimLevelCache();
+	} else {
+		/* owned by the resource, as if loaded */
+		_levelResSize = lr->size - sizeof(LevelRes);
+		free(lr);
+	}
+}
+
+void Resource::trimLevelCache() {
+	for (;;) {
+		uint32_t total = 0;
+		int lru = -1;
+		for (int i = 0; i < NUM_CACHED_LEVELS; ++i) {
+			LevelRes *lr = _levelCache[i];
+			if (lr) {
+				total += lr->size;
+				if (lr->level != _levelResNum && (lru < 0 || lr->lastUse < _levelCache[lru]->lastUse)) {
+					lru = i;
+				}
+			}
+		}
+		if (total <= _levelCacheBudget || lru < 0) {
+			break;
+		}
+		freeLevelRes(_levelCache[lru]);
+		_levelCache[lru] = 0;
+	}
+}
+
+void Resource::freeLevelRes(LevelRes *lr) {
+	freeData(lr->mbk);
+	free(lr->pal);
+	freeData(lr->map);
+	freeData(lr->lev);
+	freeData(lr->sgd);
+	freeData(lr->bnq);
+	free(lr->ani);
+	free(lr->tbn);
+	freeObjectNodes(lr->objectNodesMap, lr->numObjectNodes);
+	free(lr);
+}
+
+uint8_t *Resource::loadData(File *f) {
+	const uint32_t len = f->size();
+	if (_mappedCount < MAX_MAPPED_DATA) {
+		uint8_t *p = f->detachMapping();
+		if (p) {
+			_mapped[_mappedCount].ptr = p;
+			_mapped[_mappedCount].size = len;
+			++_mappedCount;
+			return p;
+		}
+	}
+	uint8_t *p = (uint8_t *)malloc(len);
+	if (p) {
+		f->read(p, len);
+	}
+	return p;
+}
+
+void Resource::freeData(uint8_t *p) {
+	for (int i = 0; i < _mappedCount; ++i) {
+		if (_mapped[i].ptr == p) {
+			File::unmap(p, _mapped[i].size);
+			_mapped[i] = _mapped[--_mappedCount];
+			return;
+		}
+	}
+	free(p);
 }
 
 void Resource::load_DEM(const char *filename) {
@@ -103,12 +341,19 @@ void Resource::load_FIB(const char *fileName) {
 			log_cb(RETRO_LOG_ERROR, "Unable to allocate SoundFx table\n");
 		}
 		int i;
+		/* entries are a 32-bit offset and a 16-bit length */
+		uint16_t *entries = (uint16_t *)malloc(_numSfx * 3 * sizeof(uint16_t));
+		if (!entries) {
+			log_cb(RETRO_LOG_ERROR, "Unable to allocate SoundFx table\n");
+		}
+		f.readUint16LE(entries, _numSfx * 3);
 		for (i = 0; i < _numSfx; ++i) {
 			SoundFx *sfx = &_sfxList[i];
-			sfx->offset = f.readUint32LE();
-			sfx->len = f.readUint16LE();
+			sfx->offset = entries[i * 3] | ((uint32_t)entries[i * 3 + 1] << 16);
+			sfx->len = entries[i * 3 + 2];
 			sfx->data = 0;
 		}
+		free(entries);
 		for (i = 0; i < _numSfx; ++i) {
 			SoundFx *sfx = &_sfxList[i];
 			if (sfx->len == 0) {
@@ -120,12 +365,15 @@ void Resource::load_FIB(const char *fileName) {
 				log_cb(RETRO_LOG_ERROR, "Unable to allocate SoundFx data buffer\n");
 			}
 			sfx->data = data;
-			uint8_t c = f.readByte();
+			/* read into the upper half, expanded in place from the start */
+			const uint8_t *src = data + sfx->len;
+			f.read(data + sfx->len, sfx->len);
+			uint8_t c = *src++;
 			*data++ = c;
 			*data++ = c;
 			uint16_t sz = sfx->len - 1;
 			while (sz--) {
-				uint8_t d = f.readByte();
+				uint8_t d = *src++;
 				c += fibonacciTable[d >> 4];
 				*data++ = c;
 				c += fibonacciTable[d & 15];
@@ -463,9 +711,23 @@ void Resource::load(const char *objName, int objType, const char *ext) {
 	if (ext) {
 		snprintf(_entryName, sizeof(_entryName), "%s.%s", objName, ext);
 	}
+	/* the uncompressed resources kept whole alias the file mapping */
+	bool map = false;
+	switch (objType) {
+	case OT_MBK:
+	case OT_MAP:
+	case OT_CMD:
+	case OT_POL:
+	case OT_LEV:
+	case OT_SGD:
+	case OT_BNQ:
+		map = true;
+		break;
+	}
 	File f;
-	if (f.open(_entryName, "rb", _fs)) {
+	if (f.open(_entryName, map ? "mrb" : "rb", _fs)) {
 		assert(loadStub);
+		_levelResSize += f.size();
 		(this->*loadStub)(&f);
 		if (f.ioErr()) {
 			log_cb(RETRO_LOG_ERROR, "I/O error when reading '%s'\n", _entryName);
@@ -475,6 +737,7 @@ void Resource::load(const char *objName, int objType, const char *ext) {
 			uint32_t size;
 			uint8_t *dat = _aba->loadEntry(_entryName, &size);
 			if (dat) {
+				_levelResSize += size;
 				switch (objType) {
 				case OT_MBK:
 					_mbk = dat;
@@ -521,9 +784,11 @@ void Resource::load(const char *objName, int objType, const char *ext) {
 					break;
 				case OT_CMD:
 					_cmd = dat;
+					_cmdSize = size;
 					break;
 				case OT_POL:
 					_pol = dat;
+					_polSize = size;
 					break;
 				case OT_BNQ:
 					_bnq = dat;
@@ -559,10 +824,7 @@ void Resource::load_FNT(File *f) {
 }
 
 void Resource::load_MBK(File *f) {
-	int len = f->size();
-	_mbk = (uint8_t *)malloc(len);
-	if (_mbk)
-		f->read(_mbk, len);
+	_mbk = loadData(f);
 }
 
 void Resource::load_ICN(File *f) {
@@ -618,10 +880,7 @@ void Resource::load_PAL(File *f) {
 }
 
 void Resource::load_MAP(File *f) {
-	int len = f->size();
-	_map = (uint8_t *)malloc(len);
-	if (_map)
-		f->read(_map, len);
+	_map = loadData(f);
 }
 
 void Resource::load_OBJ(File *f) {
@@ -678,10 +937,14 @@ void Resource::load_OBJ(File *f) {
 }
 
 void Resource::free_OBJ() {
+	freeObjectNodes(_objectNodesMap, _numObjectNodes);
+}
+
+void Resource::freeObjectNodes(ObjectNode **objectNodesMap, int numObjectNodes) {
 	ObjectNode *prevNode = 0;
-	for (int i = 0; i < _numObjectNodes; ++i) {
-		if (_objectNodesMap[i] != prevNode) {
-			ObjectNode *curNode = _objectNodesMap[i];
+	for (int i = 0; i < numObjectNodes; ++i) {
+		if (objectNodesMap[i] != prevNode) {
+			ObjectNode *curNode = objectNodesMap[i];
 			/* record the pointer value for the next iteration's dedup check
 			 * before freeing it -- reading it after free() is undefined
 			 * (-Wuse-after-free); prevNode is only ever compared, never
@@ -690,7 +953,7 @@ void Resource::free_OBJ() {
 			free(curNode->objects);
 			free(curNode);
 		}
-		_objectNodesMap[i] = 0;
+		objectNodesMap[i] = 0;
 	}
 }
 
@@ -844,24 +1107,20 @@ void Resource::load_TBN(File *f) {
 }
 
 void Resource::load_CMD(File *pf) {
-	free(_cmd);
-	int len = pf->size();
-	_cmd = (uint8_t *)malloc(len);
-	if (_cmd)
-		pf->read(_cmd, len);
+	freeData(_cmd);
+	_cmdSize = pf->size();
+	_cmd = loadData(pf);
 }
 
 void Resource::load_POL(File *pf) {
-	free(_pol);
-	int len = pf->size();
-	_pol = (uint8_t *)malloc(len);
-	if (_pol)
-		pf->read(_pol, len);
+	freeData(_pol);
+	_polSize = pf->size();
+	_pol = loadData(pf);
 }
 
 void Resource::load_CMP(File *pf) {
-	free(_pol);
-	free(_cmd);
+	freeData(_pol);
+	freeData(_cmd);
 	int len = pf->size();
 	uint8_t *tmp = (uint8_t *)malloc(len);
 	if (!tmp) {
@@ -885,6 +1144,7 @@ void Resource::load_CMP(File *pf) {
 		offset += packedSize;
 	}
 	_pol = (uint8_t *)malloc(data[0].size);
+	_polSize = _pol ? data[0].size : 0;
 	if (!_pol) {
 		log_cb(RETRO_LOG_ERROR, "Unable to allocate POL buffer\n");
 	}
@@ -894,6 +1154,7 @@ void Resource::load_CMP(File *pf) {
 		log_cb(RETRO_LOG_ERROR, "Bad CRC for cutscene polygon data\n");
 	}
 	_cmd = (uint8_t *)malloc(data[1].size);
+	_cmdSize = _cmd ? data[1].size : 0;
 	if (!_cmd) {
 		log_cb(RETRO_LOG_ERROR, "Unable to allocate CMD buffer\n");
 	}
@@ -979,28 +1240,20 @@ void Resource::load_SPL(File *f) {
 }
 
 void Resource::load_LEV(File *f) {
-	const int len = f->size();
-	_lev = (uint8_t *)malloc(len);
-	if (_lev)
-		f->read(_lev, len);
+	_lev = loadData(f);
 }
 
 void Resource::load_SGD(File *f) {
-	const int len = f->size();
-	_sgd = (uint8_t *)malloc(len);
+	_sgd = loadData(f);
 	if (_sgd)
 	{
-		f->read(_sgd, len);
 		// first byte == number of entries, clear to fix up 32 bits offset
 		_sgd[0] = 0;
 	}
 }
 
 void Resource::load_BNQ(File *f) {
-	const int len = f->size();
-	_bnq = (uint8_t *)malloc(len);
-	if (_bnq)
-		f->read(_bnq, len);
+	_bnq = loadData(f);
 }
 
 void Resource::load_SPM(File *f) {
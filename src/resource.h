@@ -67,6 +67,28 @@ struct LocaleData {
 	static const uint8_t _cineTxtJP[];
 };
 
+/* A file mapping adopted by Resource::loadData() */
+struct MappedData {
+	uint8_t *ptr;
+	uint32_t size;
+};
+
+/* The resources of a level as loaded from disk, kept by the level cache.
+ * _ctData is copied before gameplay modifies it. */
+struct LevelRes {
+	int        level;
+	uint32_t   lastUse;
+	uint32_t   size; /* bytes of level data, for the cache budget */
+	uint8_t    *mbk, *pal, *map, *lev, *sgd, *bnq, *ani, *tbn;
+	int        levNum;
+	uint16_t   numObjectNodes;
+	ObjectNode *objectNodesMap[255];
+	uint16_t   pgeNum;
+	InitPGE    pgeInit[256];
+	uint8_t    rp[0x4A];
+	int8_t     ctData[0x1D00];
+};
+
 struct Resource {
 	typedef void (Resource::*LoadStub)(File *);
 
@@ -105,7 +127,10 @@ struct Resource {
 		NUM_SFXS = 66,
 		NUM_BANK_BUFFERS = 50,
 		NUM_CUTSCENE_TEXTS = 117,
-		NUM_SPRITES = 1287
+		NUM_SPRITES = 1287,
+		NUM_CACHED_LEVELS = 8,
+		/* 5 per level, cached or loaded, plus the cutscene CMD and POL */
+		MAX_MAPPED_DATA = (NUM_CACHED_LEVELS + 1) * 5 + 2
 	};
 
 	static const uint16_t _voicesOffsetsTable[];
@@ -149,6 +174,7 @@ struct Resource {
 	uint8_t _numSfx;
 	uint8_t *_cmd;
 	uint8_t *_pol;
+	uint32_t _cmdSize, _polSize;
 	uint8_t *_cineStrings[NUM_CUTSCENE_TEXTS];
 	uint8_t *_cine_off;
 	uint8_t *_cine_txt;
@@ -161,6 +187,18 @@ struct Resource {
 	int _bankBuffersCount;
 	uint8_t *_dem;
 	int _demLen;
+	/* Level cache: loadLevelData() switching back to a level still in the
+	 * cache adopts its resources instead of reading them again. The least
+	 * recently used levels are dropped over _levelCacheBudget bytes; the
+	 * loaded level (_levelResNum) always stays. */
+	LevelRes *_levelCache[NUM_CACHED_LEVELS];
+	uint32_t _levelCacheBudget;
+	uint32_t _levelCacheTick;
+	int _levelResNum; /* cached level currently loaded, -1 if none */
+	uint32_t _levelResSize;
+	/* file mappings adopted by loadData() */
+	MappedData _mapped[MAX_MAPPED_DATA];
+	int _mappedCount;
 
 	Resource(FileSystem *fs, Language lang);
 	~Resource();
@@ -169,6 +207,29 @@ struct Resource {
 	void fini();
 
 	void clearLevelRes();
+	void setLevelCacheBudget(uint32_t bytes);
+	/* records the level resources just loaded */
+	void cacheLevelRes(int level);
+	/* loads the level resources from the cache, after clearLevelRes() */
+	bool loadCachedLevelRes(int level);
+	bool isLevelResCached(int level) const;
+	void trimLevelCache();
+	void freeLevelRes(LevelRes *lr);
+	/* The level resources loaded, in a new LevelRes, which then owns them.
+	 * With the mappings they alias, moved to mapped (5 entries at most),
+	 * the LevelRes can be handed to another Resource by adoptLevelRes(). */
+	LevelRes *detachLevelRes(int level, MappedData *mapped, int *mappedCount);
+	/* loads a level from a detached LevelRes, after clearLevelRes() */
+	void adoptLevelRes(LevelRes *lr, const MappedData *mapped, int mappedCount);
+	void insertLevelRes(LevelRes *lr);
+	void useLevelRes(const LevelRes *lr);
+	/* forgets the level resources now owned by a LevelRes */
+	void dropLevelRes();
+	static void freeObjectNodes(ObjectNode **objectNodesMap, int numObjectNodes);
+	/* The whole of f, in a malloc'ed buffer or the file mapping itself if
+	 * it is mapped. Either one is released by freeData(). */
+	uint8_t *loadData(File *f);
+	void freeData(uint8_t *p);
 	void load_DEM(const char *filename);
 	void load_FIB(const char *fileName);
 
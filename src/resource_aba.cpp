@@ -26,10 +26,12 @@ void ResourceAba::readEntries()
       _entries = (ResourceAbaEntry *)calloc(_entriesCount, sizeof(ResourceAbaEntry));
       for (i = 0; i < _entriesCount; ++i)
       {
+         uint32_t values[3];
          _f.read(_entries[i].name, sizeof(_entries[i].name));
-         _entries[i].offset = _f.readUint32BE();
-         _entries[i].compressedSize = _f.readUint32BE();
-         _entries[i].size = _f.readUint32BE();
+         _f.readUint32BE(values, 3);
+         _entries[i].offset = values[0];
+         _entries[i].compressedSize = values[1];
+         _entries[i].size = values[2];
          if (i != 0) {
             assert(nextOffset == _entries[i].offset);
          }
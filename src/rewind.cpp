@@ -0,0 +1,207 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "rewind.h"
+
+/* A ring entry is the encoded delta framed by its length on both sides, so
+ * it can be dropped from the tail (oldest) or popped from the head (latest):
+ *
+ *   uint32_t len | len bytes | uint32_t len
+ *
+ * The encoding is a sequence of (zero run, literal count, literals) with
+ * LEB128 counts; a literal run ends at the next pair of zero bytes. */
+
+static uint8_t *putVarint(uint8_t *p, uint32_t v) {
+	while (v >= 0x80) {
+		*p++ = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static const uint8_t *getVarint(const uint8_t *p, uint32_t *v) {
+	uint32_t r = 0;
+	int shift = 0;
+	uint8_t b;
+	do {
+		b = *p++;
+		r |= (b & 0x7F) << shift;
+		shift += 7;
+	} while ((b & 0x80) && shift < 35);
+	*v = r;
+	return p;
+}
+
+RewindBuffer::RewindBuffer()
+	: _ring(0), _ringSize(0), _head(0), _used(0), _count(0), _stateSize(0), _stateLen(0), _nextLen(0), _hasState(false),
+	  _state(0), _next(0), _enc(0) {
+}
+
+RewindBuffer::~RewindBuffer() {
+	free();
+}
+
+bool RewindBuffer::init(uint32_t stateSize, uint32_t budget) {
+	free();
+	_ring  = (uint8_t *)malloc(budget);
+	_state = (uint8_t *)malloc(stateSize);
+	_next  = (uint8_t *)malloc(stateSize);
+	/* worst case, a literal byte every third byte: 3 bytes for 3 */
+	_enc   = (uint8_t *)malloc(stateSize * 2 + 16);
+	if (!_ring || !_state || !_next || !_enc) {
+		free();
+		return false;
+	}
+	_ringSize  = budget;
+	_stateSize = stateSize;
+	_stateLen  = stateSize;
+	_nextLen   = stateSize;
+	reset();
+	return true;
+}
+
+void RewindBuffer::free() {
+	::free(_ring);
+	_ring = 0;
+	::free(_state);
+	_state = 0;
+	::free(_next);
+	_next = 0;
+	::free(_enc);
+	_enc = 0;
+	_ringSize = _stateSize = 0;
+	_stateLen = _nextLen = 0;
+	reset();
+}
+
+void RewindBuffer::reset() {
+	_head = _used = _count = 0;
+	_hasState = false;
+}
+
+void RewindBuffer::commitPush(uint32_t stateLen) {
+	if (stateLen < _nextLen) {
+		memset(_next + stateLen, 0, _nextLen - stateLen);
+	}
+	_nextLen = stateLen;
+	uint8_t *tmp = _state;
+	const uint32_t tmpLen = _stateLen;
+	if (!_hasState) {
+		_state = _next;
+		_stateLen = _nextLen;
+		_next = tmp;
+		_nextLen = tmpLen;
+		_hasState = true;
+		return;
+	}
+	/* _state becomes the delta back from the new image */
+	const uint32_t deltaLen = (tmpLen > stateLen) ? tmpLen : stateLen;
+	for (uint32_t i = 0; i < deltaLen; ++i) {
+		_state[i] ^= _next[i];
+	}
+	const uint32_t len = encode(_state, deltaLen);
+	_state = _next;
+	_stateLen = stateLen;
+	_next = tmp;
+	_nextLen = deltaLen;
+	const uint32_t size = len + 8;
+	if (size > _ringSize) {
+		/* nothing older can be reached without it */
+		_head = _used = _count = 0;
+		return;
+	}
+	while (_used + size > _ringSize) {
+		uint32_t oldLen;
+		readRing((_head + _ringSize - _used) % _ringSize, &oldLen, 4);
+		_used -= oldLen + 8;
+		--_count;
+	}
+	writeRing(_head, &len, 4);
+	writeRing((_head + 4) % _ringSize, _enc, len);
+	writeRing((_head + 4 + len) % _ringSize, &len, 4);
+	_head = (_head + size) % _ringSize;
+	_used += size;
+	++_count;
+}
+
+const uint8_t *RewindBuffer::pop() {
+	if (!_hasState) {
+		return 0;
+	}
+	if (_nextLen > _stateLen) {
+		memset(_next + _stateLen, 0, _nextLen - _stateLen);
+	}
+	memcpy(_next, _state, _stateLen);
+	_nextLen = _stateLen;
+	if (_count == 0) {
+		_hasState = false;
+	} else {
+		uint32_t len;
+		readRing((_head + _ringSize - 4) % _ringSize, &len, 4);
+		const uint32_t start = (_head + _ringSize - 4 - len) % _ringSize;
+		readRing(start, _enc, len);
+		const uint32_t end = decode(_state, _enc, len);
+		if (end > _stateLen) {
+			_stateLen = end;
+		}
+		_head = (start + _ringSize - 4) % _ringSize;
+		_used -= len + 8;
+		--_count;
+	}
+	return _next;
+}
+
+uint32_t RewindBuffer::encode(const uint8_t *delta, uint32_t size) {
+	uint8_t *p = _enc;
+	uint32_t i = 0;
+	while (i < size) {
+		const uint32_t zeroStart = i;
+		while (i < size && delta[i] == 0) {
+			++i;
+		}
+		const uint32_t litStart = i;
+		while (i < size && !(delta[i] == 0 && (i + 1 == size || delta[i + 1] == 0))) {
+			++i;
+		}
+		p = putVarint(p, litStart - zeroStart);
+		p = putVarint(p, i - litStart);
+		memcpy(p, delta + litStart, i - litStart);
+		p += i - litStart;
+	}
+	return p - _enc;
+}
+
+uint32_t RewindBuffer::decode(uint8_t *dst, const uint8_t *src, uint32_t len) {
+	const uint8_t *end = src + len;
+	uint32_t pos = 0;
+	while (src < end) {
+		uint32_t zeros, count;
+		src = getVarint(src, &zeros);
+		src = getVarint(src, &count);
+		pos += zeros;
+		if (pos + count > _stateSize || count > (uint32_t)(end - src)) {
+			break;
+		}
+		for (uint32_t i = 0; i < count; ++i) {
+			dst[pos + i] ^= src[i];
+		}
+		src += count;
+		pos += count;
+	}
+	return (pos < _stateSize) ? pos : _stateSize;
+}
+
+void RewindBuffer::writeRing(uint32_t pos, const void *src, uint32_t len) {
+	const uint32_t n = (len < _ringSize - pos) ? len : _ringSize - pos;
+	memcpy(_ring + pos, src, n);
+	memcpy(_ring, (const uint8_t *)src + n, len - n);
+}
+
+void RewindBuffer::readRing(uint32_t pos, void *dst, uint32_t len) {
+	const uint32_t n = (len < _ringSize - pos) ? len : _ringSize - pos;
+	memcpy(dst, _ring + pos, n);
+	memcpy((uint8_t *)dst + n, _ring, len - n);
+}
@@ -0,0 +1,56 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef REWIND_H__
+#define REWIND_H__
+
+#include "intern.h"
+
+/* Rewind history of state images of up to stateSize bytes. Only the latest
+ * image is kept whole; each older one is stored in a byte ring as the XOR of
+ * the two consecutive images, run-length encoded, so a frame where little
+ * changed costs a few dozen bytes. The oldest entries are dropped once the
+ * ring is full. The bytes past the end of an image are kept zero, so the XOR
+ * only goes over the longer of the two images. */
+struct RewindBuffer {
+	uint8_t  *_ring;
+	uint32_t _ringSize;
+	uint32_t _head;  /* write position */
+	uint32_t _used;  /* bytes of the ring in use, ending at _head */
+	uint32_t _count; /* deltas in the ring */
+	uint32_t _stateSize;
+	uint32_t _stateLen; /* bytes of _state that may be non-zero */
+	uint32_t _nextLen;  /* same for _next */
+	bool     _hasState;
+	uint8_t  *_state; /* latest image */
+	uint8_t  *_next;  /* image being pushed, or popped */
+	uint8_t  *_enc;   /* encoded delta */
+
+	RewindBuffer();
+	~RewindBuffer();
+
+	/* budget is the ring size, the images take another 4 * stateSize */
+	bool init(uint32_t stateSize, uint32_t budget);
+	void free();
+	void reset();
+
+	bool isEnabled() const { return _ring != 0; }
+	/* frames that can be stepped back */
+	uint32_t getCount() const { return _hasState ? _count + 1 : 0; }
+
+	/* fill the first len of the returned stateSize bytes, then commitPush() */
+	uint8_t *beginPush() { return _next; }
+	void commitPush(uint32_t len);
+	/* the latest image, removed from the history; NULL when empty */
+	const uint8_t *pop();
+
+	uint32_t encode(const uint8_t *delta, uint32_t size);
+	/* returns the end of the delta in dst */
+	uint32_t decode(uint8_t *dst, const uint8_t *src, uint32_t len);
+	void writeRing(uint32_t pos, const void *src, uint32_t len);
+	void readRing(uint32_t pos, void *dst, uint32_t len);
+};
+
+#endif // REWIND_H__
@@ -0,0 +1,121 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "room_cache.h"
+
+RoomCache::RoomCache()
+	: _entries(0), _entriesCount(0), _budget(0), _tick(0), _pendingLevel(-1), _pendingCount(0) {
+	setBudget(4 << 20);
+}
+
+RoomCache::~RoomCache() {
+	clear();
+	free(_entries);
+}
+
+void RoomCache::setBudget(uint32_t bytes) {
+	int count = bytes / (BITMAP_SIZE + sizeof(Entry));
+	if (count > MAX_ENTRIES) {
+		count = MAX_ENTRIES;
+	}
+	_budget = bytes;
+	if (count == _entriesCount) {
+		return;
+	}
+	clear();
+	free(_entries);
+	_entries = 0;
+	_entriesCount = 0;
+	if (count != 0) {
+		_entries = (Entry *)calloc(count, sizeof(Entry));
+		if (!_entries) {
+			log_cb(RETRO_LOG_ERROR, "[RE]: Unable to allocate room cache\n");
+			return;
+		}
+		_entriesCount = count;
+		for (int i = 0; i < count; ++i) {
+			_entries[i].level = -1;
+		}
+	}
+}
+
+void RoomCache::clear() {
+	for (int i = 0; i < _entriesCount; ++i) {
+		free(_entries[i].bitmap);
+		_entries[i].bitmap = 0;
+		_entries[i].level = -1;
+	}
+	_pendingCount = 0;
+}
+
+RoomCache::Entry *RoomCache::find(int level, int room) {
+	for (int i = 0; i < _entriesCount; ++i) {
+		Entry *e = &_entries[i];
+		if (e->level == level && e->room == room) {
+			e->lastUse = ++_tick;
+			return e;
+		}
+	}
+	return 0;
+}
+
+RoomCache::Entry *RoomCache::insert(int level, int room) {
+	if (_entriesCount == 0) {
+		return 0;
+	}
+	Entry *e = &_entries[0];
+	for (int i = 0; i < _entriesCount; ++i) {
+		if (_entries[i].level < 0) {
+			e = &_entries[i];
+			break;
+		}
+		if (_entries[i].lastUse < e->lastUse) {
+			e = &_entries[i];
+		}
+	}
+	if (!e->bitmap) {
+		e->bitmap = (uint8_t *)malloc(BITMAP_SIZE);
+		if (!e->bitmap) {
+			e->level = -1;
+			return 0;
+		}
+	}
+	e->level = level;
+	e->room = room;
+	e->lastUse = ++_tick;
+	return e;
+}
+
+void RoomCache::setPending(int level, const uint8_t *rooms, int count) {
+	_pendingLevel = level;
+	_pendingCount = 0;
+	if (_entriesCount == 0) {
+		return;
+	}
+	for (int i = 0; i < count && i < (int)ARRAY_SIZE(_pending); ++i) {
+		_pending[_pendingCount++] = rooms[i];
+	}
+}
+
+bool RoomCache::nextPending(int level, int *room) {
+	if (level != _pendingLevel) {
+		_pendingCount = 0;
+	}
+	while (_pendingCount > 0) {
+		const int r = _pending[--_pendingCount];
+		bool cached = false;
+		for (int i = 0; i < _entriesCount; ++i) {
+			if (_entries[i].level == level && _entries[i].room == r) {
+				cached = true;
+				break;
+			}
+		}
+		if (!cached) {
+			*room = r;
+			return true;
+		}
+	}
+	return false;
+}
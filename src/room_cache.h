@@ -0,0 +1,53 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef ROOM_CACHE_H__
+#define ROOM_CACHE_H__
+
+#include "intern.h"
+
+/* Decoded room backgrounds, keyed by level and room, with the palette slots
+ * of the room. Walking back into a room copies it from here instead of
+ * decoding the .MAP planes or the .LEV tiles again. The least recently used
+ * room is replaced once the budget is reached. The rooms next to the current
+ * one are queued, to be decoded ahead on idle frames. */
+struct RoomCache {
+	enum {
+		BITMAP_SIZE = 256 * 224,
+		MAX_ENTRIES = 512
+	};
+
+	struct Entry {
+		int      level; /* -1 if free */
+		int      room;
+		uint8_t  palSlots[4];
+		uint32_t lastUse;
+		uint8_t  *bitmap;
+	};
+
+	Entry    *_entries;
+	int      _entriesCount;
+	uint32_t _budget;
+	uint32_t _tick;
+	int      _pendingLevel;
+	uint8_t  _pending[4];
+	int      _pendingCount;
+
+	RoomCache();
+	~RoomCache();
+
+	/* drops all the rooms if the number of entries changes */
+	void setBudget(uint32_t bytes);
+	void clear();
+	Entry *find(int level, int room);
+	/* the entry to decode the room to, 0 if the budget is too small */
+	Entry *insert(int level, int room);
+
+	void setPending(int level, const uint8_t *rooms, int count);
+	/* the next queued room of level, not cached yet */
+	bool nextPending(int level, int *room);
+};
+
+#endif // ROOM_CACHE_H__
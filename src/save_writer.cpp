@@ -0,0 +1,174 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <compat/strl.h>
+#include <streams/file_stream.h>
+#include "file.h"
+#include "save_writer.h"
+
+SaveWriter::SaveWriter()
+	: _proc(0), _userData(0), _pending(0), _done(0), _inFlight(0) {
+#ifdef HAVE_STD_THREADS
+	_quit = false;
+#endif
+}
+
+SaveWriter::~SaveWriter() {
+	flush();
+#ifdef HAVE_STD_THREADS
+	if (_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+		}
+		_cond.notify_one();
+		_thread.join();
+	}
+#endif
+	/* nobody is left to report to */
+	while (_done) {
+		Job *next = _done->next;
+		free(_done);
+		_done = next;
+	}
+}
+
+void SaveWriter::setCallback(SaveWriterProc proc, void *userData) {
+	_proc = proc;
+	_userData = userData;
+}
+
+void SaveWriter::append(Job **list, Job *job) {
+	job->next = 0;
+	while (*list) {
+		list = &(*list)->next;
+	}
+	*list = job;
+}
+
+void SaveWriter::post(const char *directory, const char *filename, uint8_t *buf, uint32_t size, int slot) {
+	Job *job = (Job *)malloc(sizeof(Job));
+	if (!job) {
+		log_cb(RETRO_LOG_ERROR, "[RE]: Unable to allocate save job\n");
+		free(buf);
+		if (_proc) {
+			_proc(_userData, slot, false);
+		}
+		return;
+	}
+	if (!directory) {
+		/* no save directory, as in headless batch runs: drop the file */
+		free(buf);
+		job->buf = 0;
+		job->slot = slot;
+		job->success = true;
+#ifdef HAVE_STD_THREADS
+		std::lock_guard<std::mutex> lock(_mutex);
+#endif
+		append(&_done, job);
+		return;
+	}
+	strlcpy(job->directory, directory, sizeof(job->directory));
+	strlcpy(job->filename, filename, sizeof(job->filename));
+	job->buf = buf;
+	job->size = size;
+	job->slot = slot;
+	job->success = false;
+#ifdef HAVE_STD_THREADS
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		append(&_pending, job);
+		++_inFlight;
+		if (!_thread.joinable()) {
+			_thread = std::thread(&SaveWriter::run, this);
+		}
+	}
+	_cond.notify_one();
+#else
+	job->success = writeFile(job);
+	append(&_done, job);
+#endif
+}
+
+void SaveWriter::flush() {
+#ifdef HAVE_STD_THREADS
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (_inFlight != 0) {
+		_idleCond.wait(lock);
+	}
+#endif
+}
+
+void SaveWriter::poll() {
+	Job *done;
+#ifdef HAVE_STD_THREADS
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		done = _done;
+		_done = 0;
+	}
+#else
+	done = _done;
+	_done = 0;
+#endif
+	while (done) {
+		Job *next = done->next;
+		if (_proc) {
+			_proc(_userData, done->slot, done->success);
+		}
+		free(done);
+		done = next;
+	}
+}
+
+bool SaveWriter::writeFile(Job *job) {
+	char tmpName[sizeof(job->filename) + 4];
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", job->filename);
+	bool success = false;
+	{
+		File f;
+		if (f.open(tmpName, "wb", job->directory)) {
+			f.write(job->buf, job->size);
+			success = !f.ioErr();
+		}
+	}
+	free(job->buf);
+	job->buf = 0;
+	char tmpPath[sizeof(job->directory) + sizeof(tmpName) + 1];
+	char path[sizeof(job->directory) + sizeof(tmpName) + 1];
+	snprintf(tmpPath, sizeof(tmpPath), "%s/%s", job->directory, tmpName);
+	snprintf(path, sizeof(path), "%s/%s", job->directory, job->filename);
+	if (success && filestream_rename(tmpPath, path) != 0) {
+		/* not atomic there, rename does not replace an existing file */
+		filestream_delete(path);
+		success = (filestream_rename(tmpPath, path) == 0);
+	}
+	if (!success) {
+		filestream_delete(tmpPath);
+	}
+	return success;
+}
+
+#ifdef HAVE_STD_THREADS
+void SaveWriter::run() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (;;) {
+		while (!_pending && !_quit) {
+			_cond.wait(lock);
+		}
+		if (!_pending) {
+			return;
+		}
+		Job *job = _pending;
+		_pending = job->next;
+		lock.unlock();
+		job->success = writeFile(job);
+		lock.lock();
+		append(&_done, job);
+		--_inFlight;
+		_idleCond.notify_all();
+	}
+}
+#endif
@@ -0,0 +1,65 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef SAVE_WRITER_H__
+#define SAVE_WRITER_H__
+
+#include "intern.h"
+#ifdef HAVE_STD_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+typedef void (*SaveWriterProc)(void *userData, int slot, bool success);
+
+/* Writes save files in the background. A file is written to a temporary
+ * name and renamed over the previous one, so a crash or power loss leaves
+ * either the old or the new file. Completions are reported by poll(), on
+ * the caller's thread, in the order the files were posted. Without
+ * HAVE_STD_THREADS post() writes the file before returning. */
+struct SaveWriter {
+	struct Job {
+		char     directory[PATH_MAX_LENGTH];
+		char     filename[64];
+		uint8_t  *buf;
+		uint32_t size;
+		int      slot;
+		bool     success;
+		Job      *next;
+	};
+
+	SaveWriterProc _proc;
+	void           *_userData;
+	Job            *_pending; /* oldest first */
+	Job            *_done;
+	int            _inFlight; /* posted, not yet written */
+#ifdef HAVE_STD_THREADS
+	std::thread             _thread;
+	std::mutex              _mutex;
+	std::condition_variable _cond;
+	std::condition_variable _idleCond;
+	bool                    _quit;
+#endif
+
+	SaveWriter();
+	~SaveWriter();
+
+	void setCallback(SaveWriterProc proc, void *userData);
+	/* takes ownership of the malloc'ed buf, a NULL directory discards it */
+	void post(const char *directory, const char *filename, uint8_t *buf, uint32_t size, int slot);
+	/* waits for the posted files to be written */
+	void flush();
+	/* calls back for the files written since the last call */
+	void poll();
+
+	static void append(Job **list, Job *job);
+	static bool writeFile(Job *job);
+#ifdef HAVE_STD_THREADS
+	void run();
+#endif
+};
+
+#endif // SAVE_WRITER_H__
@@ -104,9 +104,7 @@ void SeqDemuxer::readPalette(uint8_t *dst) {
 
 void SeqDemuxer::readAudio(int16_t *dst) {
 	_f->seek(_frameOffset + _audioDataOffset);
-	for (int i = 0; i < kAudioBufferSize; ++i) {
-		dst[i] = _f->readUint16BE();
-	}
+	_f->readUint16BE((uint16_t *)dst, kAudioBufferSize);
 }
 
 struct BitStream {
@@ -363,6 +361,7 @@ void SeqPlayer::play(File *f) {
 
 bool SeqPlayer::mix(int16_t *buf, int samples) {
 	if (_soundQueuePreloadSize < kSoundPreloadSize) {
+		memset(buf, 0, samples * sizeof(int16_t));
 		return true;
 	}
 	while (_soundQueue && samples > 0) {
@@ -376,6 +375,7 @@ bool SeqPlayer::mix(int16_t *buf, int samples) {
 		}
 		--samples;
 	}
+	memset(buf, 0, samples * sizeof(int16_t));
 	return true;
 }
 
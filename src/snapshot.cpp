@@ -0,0 +1,680 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "game.h"
+#include "resource.h"
+
+/* Compact in-memory snapshots, for the frontend's serialize/unserialize (and
+ * so run-ahead and rewind, which serialize every frame). Every field is
+ * written little-endian at a fixed width, bool and 8-bit values as a byte,
+ * so a snapshot moves between 32 and 64-bit builds and byte orders (netplay
+ * across platforms). Pointer members are stored as 1-based uint16_t indices
+ * into the array they point to (0 is NULL), pointers into resource data as
+ * offsets and pointers to the video layers as layer numbers.
+ *
+ * Besides the gameplay state, a snapshot holds the whole frame-driver state
+ * (task stack, cutscene VM, story text, inventory, config and continue
+ * panels, fades, the video layers and palette, the sound effect channels),
+ * so it can be taken and restored at any frame. Only the music position is
+ * left out, the players keep going. The back layer is stored as the room it
+ * holds and the two temp layers only while the cutscene, story text or
+ * continue tasks use them, so a gameplay snapshot is about 80 KB and
+ * getSnapshotSize() is the largest one, with both temp layers.
+ *
+ * A snapshot is read twice when loaded: a check pass goes over the whole
+ * stream and validates the indices without changing anything, then the load
+ * pass applies it. */
+
+static const uint32_t TAG_FBSN = 0x4642534E;
+static const uint16_t SNAPSHOT_VERSION = 3;
+static const uint32_t SNAPSHOT_HEADER_SIZE = 16;
+
+enum {
+	SF_GLOBAL_DATA = 1 << 0,
+	SF_LEVEL_DATA  = 1 << 1
+};
+
+struct SnapshotStream {
+	enum {
+		MODE_SIZE,
+		MODE_SAVE,
+		MODE_CHECK,
+		MODE_LOAD
+	};
+
+	int      mode;
+	uint8_t  *buf;
+	uint32_t size;
+	uint32_t pos;
+	bool     err;
+	bool     cutData; /* the cutscene data loaded is the snapshot's */
+
+	SnapshotStream(int m, uint8_t *b, uint32_t sz)
+		: mode(m), buf(b), size(sz), pos(0), err(false), cutData(true) {
+	}
+
+	bool reading() const {
+		return mode == MODE_CHECK || mode == MODE_LOAD;
+	}
+	/* the next n bytes of the snapshot, 0 when sizing or past the end */
+	uint8_t *advance(uint32_t n) {
+		uint8_t *q = 0;
+		if (mode != MODE_SIZE) {
+			if (pos + n > size) {
+				err = true;
+			} else {
+				q = buf + pos;
+			}
+		}
+		pos += n;
+		return q;
+	}
+	void bytes(void *p, uint32_t n) {
+		uint8_t *q = advance(n);
+		if (q && mode == MODE_SAVE) {
+			memcpy(q, p, n);
+		} else if (q && mode == MODE_LOAD) {
+			memcpy(p, q, n);
+		}
+	}
+	template <typename T>
+	void integer(T &v, bool store) {
+		uint8_t *q = advance(sizeof(T));
+		if (!q) {
+			return;
+		}
+		if (mode == MODE_SAVE) {
+			const uint32_t n = (uint32_t)v;
+			for (unsigned i = 0; i < sizeof(T); ++i) {
+				q[i] = n >> (i * 8);
+			}
+		} else if (store) {
+			uint32_t n = 0;
+			for (unsigned i = 0; i < sizeof(T); ++i) {
+				n |= (uint32_t)q[i] << (i * 8);
+			}
+			v = (T)n;
+		}
+	}
+	/* live state, only written by the load pass */
+	void field(bool &v) {
+		uint8_t b = v;
+		integer(b, mode == MODE_LOAD);
+		if (mode == MODE_LOAD) {
+			v = b != 0;
+		}
+	}
+	void field(char &v)     { integer(v, mode == MODE_LOAD); }
+	void field(int8_t &v)   { integer(v, mode == MODE_LOAD); }
+	void field(uint8_t &v)  { integer(v, mode == MODE_LOAD); }
+	void field(int16_t &v)  { integer(v, mode == MODE_LOAD); }
+	void field(uint16_t &v) { integer(v, mode == MODE_LOAD); }
+	void field(int32_t &v)  { integer(v, mode == MODE_LOAD); }
+	void field(uint32_t &v) { integer(v, mode == MODE_LOAD); }
+	template <typename T, size_t N>
+	void field(T (&a)[N]) {
+		for (size_t i = 0; i < N; ++i) {
+			field(a[i]);
+		}
+	}
+	template <size_t N>
+	void field(uint8_t (&a)[N]) {
+		bytes(a, N);
+	}
+	/* a local copy, read by both passes */
+	template <typename T>
+	void value(T &v) {
+		integer(v, reading());
+	}
+};
+
+/* the resources to load before the state can be read back */
+struct SnapshotHeader {
+	uint32_t tag;
+	uint16_t version;
+	uint8_t  level;
+	uint8_t  flags;
+	uint16_t cutName;
+	uint16_t pad;
+	uint32_t size;
+
+	void transfer(SnapshotStream &s) {
+		s.value(tag);
+		s.value(version);
+		s.value(level);
+		s.value(flags);
+		s.value(cutName);
+		s.value(pad);
+		s.value(size);
+	}
+};
+
+/* p as a 1-based index into base[0..count), 0 for NULL */
+template <typename T, typename B>
+static void xferIndex(SnapshotStream &s, T *&p, B *base, int count) {
+	uint16_t idx = 0;
+	if (s.mode == SnapshotStream::MODE_SAVE && p) {
+		idx = p - base + 1;
+	}
+	s.value(idx);
+	if (s.reading()) {
+		if (idx > count) {
+			s.err = true;
+			idx = 0;
+		}
+		if (s.mode == SnapshotStream::MODE_LOAD) {
+			p = idx ? base + idx - 1 : 0;
+		}
+	}
+}
+
+template <typename T>
+static void xferTable(SnapshotStream &s, T **table, int count, T *base, int baseCount) {
+	for (int i = 0; i < count; ++i) {
+		xferIndex(s, table[i], base, baseCount);
+	}
+}
+
+/* pointer into base[0..count) as an offset, 0xFFFFFFFF for NULL */
+template <typename T>
+static void xferOffset(SnapshotStream &s, T *&p, T *base, uint32_t count, bool check = true) {
+	uint32_t off = 0xFFFFFFFF;
+	if (s.mode == SnapshotStream::MODE_SAVE && p && base) {
+		off = p - base;
+	}
+	s.value(off);
+	if (s.reading() && check && off != 0xFFFFFFFF && (!base || off >= count)) {
+		s.err = true;
+		off = 0xFFFFFFFF;
+	}
+	if (s.mode == SnapshotStream::MODE_LOAD) {
+		p = (off == 0xFFFFFFFF || !base) ? 0 : base + off;
+	}
+}
+
+template <typename T>
+static void xferLayer(SnapshotStream &s, Video &vid, T *&p) {
+	uint8_t *layers[] = { vid._frontLayer, vid._backLayer, vid._tempLayer, vid._tempLayer2 };
+	int8_t num = -1;
+	if (s.mode == SnapshotStream::MODE_SAVE) {
+		for (int i = 0; i < 4; ++i) {
+			if (p == layers[i]) {
+				num = i;
+			}
+		}
+	}
+	s.value(num);
+	if (s.reading() && (num < -1 || num >= 4)) {
+		s.err = true;
+		num = -1;
+	}
+	if (s.mode == SnapshotStream::MODE_LOAD) {
+		p = (num >= 0) ? layers[num] : 0;
+	}
+}
+
+static void xferPge(SnapshotStream &s, LivePGE *pge, LivePGE *live, InitPGE *init) {
+	s.field(pge->obj_type);
+	s.field(pge->pos_x);
+	s.field(pge->pos_y);
+	s.field(pge->anim_seq);
+	s.field(pge->room_location);
+	s.field(pge->life);
+	s.field(pge->counter_value);
+	s.field(pge->collision_slot);
+	s.field(pge->next_inventory_PGE);
+	s.field(pge->current_inventory_PGE);
+	s.field(pge->unkF);
+	s.field(pge->anim_number);
+	s.field(pge->flags);
+	s.field(pge->index);
+	s.field(pge->first_obj_number);
+	xferIndex(s, pge->next_PGE_in_room, live, 256);
+	xferIndex(s, pge->init_PGE, init, 256);
+}
+
+void Game::snapshotTransfer(SnapshotStream &s) {
+	const uint16_t prevVoiceText = _textToDisplay;
+	const int prevVoiceSeg = _stChunk.data ? _stSeg - 1 : -1;
+
+	s.field(_skillLevel);
+	s.field(_score);
+	s.field(_currentRoom);
+	s.field(_loadMap);
+	s.field(_printLevelCodeCounter);
+	s.field(_randSeed);
+	s.field(_currentInventoryIconNum);
+	s.field(_blinkingConradCounter);
+	uint16_t textToDisplay = _textToDisplay;
+	s.value(textToDisplay);
+	if (s.reading() && textToDisplay != 0xFFFF &&
+		(!_res._stringsTable || textToDisplay >= READ_LE_UINT16(_res._stringsTable) / 2)) {
+		s.err = true;
+		textToDisplay = 0xFFFF;
+	}
+	if (s.mode == SnapshotStream::MODE_LOAD) {
+		_textToDisplay = textToDisplay;
+	}
+	s.field(_deathCutsceneCounter);
+	s.field(_saveStateCompleted);
+	s.field(_validSaveState);
+	s.field(_endLoop);
+	s.field(_demoBin);
+	s.field(_frameTimestamp);
+	s.field(_lastTimestamp);
+	s.field(_paceAccumMs);
+	s.field(_cut._id);
+	s.field(_cut._deathCutsceneId);
+	s.field(_inp_lastKeysHit);
+	s.field(_inp_lastKeysHitLeftRight);
+	s.field(_inp_demPos);
+	s.field(_pge_playAnimSound);
+	s.field(_pge_currentPiegeRoom);
+	s.field(_pge_currentPiegeFacingDir);
+	s.field(_pge_processOBJ);
+	s.field(_pge_inpKeysMask);
+	s.field(_pge_opTempVar1);
+	s.field(_pge_opTempVar2);
+	s.field(_pge_compareVar1);
+	s.field(_pge_compareVar2);
+
+	for (int i = 0; i < 256; ++i) {
+		xferPge(s, &_pgeLive[i], _pgeLive, _res._pgeInit);
+	}
+	xferTable(s, _pge_liveTable1, 256, _pgeLive, 256);
+	xferTable(s, _pge_liveTable2, 256, _pgeLive, 256);
+
+	for (int i = 0; i < 256; ++i) {
+		GroupPGE *le = &_pge_groups[i];
+		xferIndex(s, le->next_entry, _pge_groups, 256);
+		s.field(le->index);
+		s.field(le->group_id);
+	}
+	xferTable(s, _pge_groupsTable, 256, _pge_groups, 256);
+	xferTable(s, &_pge_nextFreeGroup, 1, _pge_groups, 256);
+
+	s.bytes(&_res._ctData[0x100], 0x1C00);
+
+	int8_t *ctRoomData = &_res._ctData[0x100];
+	for (int i = 0; i < 256; ++i) {
+		CollisionSlot2 *cs2 = &_col_slots2[i];
+		xferIndex(s, cs2->next_slot, _col_slots2, 256);
+		xferIndex(s, cs2->unk2, ctRoomData, 0x1C00);
+		s.field(cs2->data_size);
+		s.field(cs2->data_buf);
+	}
+	/* the cursor may point one past the end of the array */
+	xferTable(s, &_col_slots2Cur, 1, _col_slots2, 257);
+	xferTable(s, &_col_slots2Next, 1, _col_slots2, 257);
+
+	// frame driver
+	for (int i = 0; i < (int)ARRAY_SIZE(_task); ++i) {
+		s.field(_task[i].tag);
+		s.field(_task[i].phase);
+		s.field(_task[i].saved);
+	}
+	int32_t taskTop = _taskTop;
+	s.value(taskTop);
+	if (s.reading() && (taskTop < -1 || taskTop >= (int)ARRAY_SIZE(_task))) {
+		s.err = true;
+	}
+	if (s.mode == SnapshotStream::MODE_LOAD) {
+		_taskTop = taskTop;
+	}
+	s.field(_cutPushId);
+	s.field(_state);
+	s.field(running);
+	s.field(_frameMsCarry);
+	s.field(_frameSamplesCarry);
+	s.field(_pi.dirMask);
+	s.field(_pi.use);
+	s.field(_pi.weapon);
+	s.field(_pi.action);
+	s.field(_pi.inventory_skip);
+	s.field(_pi.escape);
+	s.field(_pi.lastChar);
+	s.field(_pi.save);
+	s.field(_pi.load);
+	s.field(_pi.stateSlot);
+	s.field(_pi.dbgMask);
+	s.field(_pi.quit);
+	s.field(_currentIcon);
+	s.field(_curMonsterNum);
+	s.field(_curMonsterFrame);
+	s.field(_finalScoreStarted);
+	s.field(_caTimeout);
+	s.field(_caCurrentColor);
+	s.field(_caColors);
+	s.field(_caColorInc);
+	s.field(_caCol.r);
+	s.field(_caCol.g);
+	s.field(_caCol.b);
+	s.field(_caResume);
+	s.field(_caResult);
+	s.field(_cpColors);
+	s.field(_cpCurrent);
+	s.field(_cpSleeping);
+	s.field(_cpResult);
+	xferTable(s, &_invSelectedPge, 1, _pgeLive, 256);
+	for (int i = 0; i < 24; ++i) {
+		InventoryItem *item = &_invItems[i];
+		s.field(item->icon_num);
+		xferIndex(s, item->init_pge, _res._pgeInit, 256);
+		xferIndex(s, item->live_pge, _pgeLive, 256);
+	}
+	s.field(_invNumItems);
+	s.field(_invCurrentItem);
+	s.field(_invNumLines);
+	s.field(_invCurrentLine);
+	s.field(_invDisplayScore);
+	s.field(_invSleeping);
+	const uint8_t *textBase = 0;
+	uint32_t textSize = 0;
+	if (s.mode != SnapshotStream::MODE_SIZE && textToDisplay != 0xFFFF && _res._stringsTable) {
+		textBase = _res.getGameString(textToDisplay);
+		textSize = strlen((const char *)textBase) + 1;
+	}
+	xferOffset(s, _stStr, textBase, textSize);
+	s.field(_stTextColor);
+	s.field(_stSeg);
+	s.field(_stPhase);
+	s.field(_stWaitSleeping);
+	/* the voice of the current story text segment, read again unless it is
+	 * the one already loaded */
+	int32_t voiceSeg = _stChunk.data ? _stSeg - 1 : -1;
+	s.value(voiceSeg);
+	if (s.mode == SnapshotStream::MODE_LOAD && !(voiceSeg == prevVoiceSeg && _textToDisplay == prevVoiceText)) {
+		free(_stChunk.data);
+		_stChunk.data = NULL;
+		_stChunk.len  = 0;
+		if (voiceSeg >= 0 && _textToDisplay != 0xFFFF) {
+			_res.load_VCE(_textToDisplay, voiceSeg, &_stChunk.data, &_stChunk.len);
+		}
+	}
+
+	// sound effects, the sample as a _sfxList index, -2 for the story text voice
+	for (int i = 0; i < Mixer::NUM_CHANNELS; ++i) {
+		MixerChannel *ch = &_mix._channels[i];
+		int16_t sound = -1;
+		if (s.mode == SnapshotStream::MODE_SAVE && ch->active && ch->chunk.data) {
+			if (ch->chunk.data == _stChunk.data) {
+				sound = -2;
+			}
+			for (int j = 0; j < _res._numSfx; ++j) {
+				if (ch->chunk.data == _res._sfxList[j].data) {
+					sound = j;
+					break;
+				}
+			}
+		}
+		s.value(sound);
+		s.field(ch->active);
+		s.field(ch->volume);
+		s.field(ch->chunkPos);
+		s.field(ch->chunkInc);
+		if (s.mode == SnapshotStream::MODE_LOAD) {
+			ch->chunk.data = 0;
+			ch->chunk.len  = 0;
+			if (sound == -2) {
+				ch->chunk = _stChunk;
+			} else if (sound >= 0 && sound < _res._numSfx) {
+				ch->chunk.data = _res._sfxList[sound].data;
+				ch->chunk.len  = _res._sfxList[sound].len;
+			}
+			ch->active = ch->active && ch->chunk.data;
+		}
+	}
+
+	// cutscene
+	s.field(_cut._interrupted);
+	s.field(_cut._stop);
+	xferOffset(s, _cut._polPtr, _res._pol, _res._polSize, s.cutData);
+	xferOffset(s, _cut._cmdPtr, _res._cmd, _res._cmdSize, s.cutData);
+	xferOffset(s, _cut._cmdPtrBak, _res._cmd, _res._cmdSize, s.cutData);
+	s.field(_cut._tstamp);
+	s.field(_cut._frameDelay);
+	s.field(_cut._newPal);
+	s.field(_cut._palBuf);
+	s.field(_cut._startOffset);
+	s.field(_cut._creditsSequence);
+	s.field(_cut._rotMat);
+	s.field(_cut._primitiveColor);
+	s.field(_cut._clearScreen);
+	s.field(_cut._hasAlphaColor);
+	s.field(_cut._varText);
+	s.field(_cut._varKey);
+	s.field(_cut._textSep);
+	s.field(_cut._textBuf);
+	xferOffset(s, _cut._textCurPtr, (const uint8_t *) Cutscene::_creditsDataDOS, Cutscene::_creditsDataDOSSize);
+	xferOffset(s, _cut._textCurBuf, (uint8_t *) _cut._textBuf, sizeof(_cut._textBuf));
+	s.field(_cut._textUnk2);
+	s.field(_cut._creditsTextPosX);
+	s.field(_cut._creditsTextPosY);
+	s.field(_cut._creditsTextCounter);
+	xferLayer(s, _vid, _cut._page0);
+	xferLayer(s, _vid, _cut._page1);
+	xferLayer(s, _vid, _cut._pageC);
+	s.field(_cut._stepOp);
+	s.field(_cut._stepPhase);
+	s.field(_cut._spPhase);
+	s.field(_cut._waitSyncN);
+	xferOffset(s, _cut._credSeqPtr, (const uint16_t *) Cutscene::_creditsCutSeq, Cutscene::_creditsCutSeqCount);
+	s.field(_cut._credPumping);
+
+	// video, the back layer is a decoded room: only the room is kept and the
+	// layer is copied again on load
+	s.bytes(_vid._frontLayer, Video::GAMESCREEN_SIZE);
+	int8_t backLevel = _vid._backLevel;
+	int8_t backRoom = _vid._backRoom;
+	s.value(backLevel);
+	s.value(backRoom);
+	if (s.reading() && (backLevel < -1 || backLevel >= 7 || backRoom < -1 || backRoom >= 0x40 ||
+		(backLevel >= 0 && backRoom < 0))) {
+		s.err = true;
+	}
+	if (s.mode == SnapshotStream::MODE_LOAD && !s.err) {
+		if (backLevel != _currentLevel || !_res._ani || !hasLevelMap(backLevel, backRoom)) {
+			backLevel = -1;
+		}
+		_vid.PC_loadBackLayer(backLevel, backRoom);
+	}
+	// the temp layers only while a task draws through them
+	uint8_t tempLayers = 0;
+	if (s.mode == SnapshotStream::MODE_SIZE) {
+		tempLayers = 3;
+	} else if (s.mode == SnapshotStream::MODE_SAVE) {
+		for (int i = 0; i <= _taskTop; ++i) {
+			switch (_task[i].tag) {
+			case TASK_CUTSCENE:
+				tempLayers |= 3;
+				break;
+			case TASK_STORYTEXT:
+			case TASK_CONTINUEABORT:
+				tempLayers |= 1;
+				break;
+			}
+		}
+		if (_vid._lastPresent.buf == _vid._tempLayer) {
+			tempLayers |= 1;
+		} else if (_vid._lastPresent.buf == _vid._tempLayer2) {
+			tempLayers |= 2;
+		}
+	}
+	s.value(tempLayers);
+	if (s.reading() && (tempLayers & ~3)) {
+		s.err = true;
+	}
+	if (tempLayers & 1) {
+		s.bytes(_vid._tempLayer, Video::GAMESCREEN_SIZE);
+	}
+	if (tempLayers & 2) {
+		s.bytes(_vid._tempLayer2, Video::GAMESCREEN_SIZE);
+	}
+	for (int i = 0; i < 256; ++i) {
+		Color c;
+		c.r = _vid._rgbPalette[i] >> 16;
+		c.g = _vid._rgbPalette[i] >> 8;
+		c.b = _vid._rgbPalette[i];
+		s.value(c.r);
+		s.value(c.g);
+		s.value(c.b);
+		if (s.mode == SnapshotStream::MODE_LOAD) {
+			_vid.setPaletteEntry(i, &c);
+		}
+	}
+	s.field(_vid._unkPalSlot1);
+	s.field(_vid._unkPalSlot2);
+	s.field(_vid._mapPalSlot1);
+	s.field(_vid._mapPalSlot2);
+	s.field(_vid._mapPalSlot3);
+	s.field(_vid._mapPalSlot4);
+	s.field(_vid._charFrontColor);
+	s.field(_vid._charTransparentColor);
+	s.field(_vid._charShadowColor);
+	s.field(_vid._shakeOffset);
+	s.field(_vid._fadeStep);
+	s.field(_vid._lastPresent.frontLayer);
+	xferLayer(s, _vid, _vid._lastPresent.buf);
+	s.field(_vid._lastPresent.pitch);
+}
+
+size_t Game::getSnapshotSize() {
+	SnapshotStream s(SnapshotStream::MODE_SIZE, 0, 0);
+	snapshotTransfer(s);
+	return SNAPSHOT_HEADER_SIZE + s.pos;
+}
+
+size_t Game::saveSnapshot(uint8_t *dst, size_t size) {
+	if (size < getSnapshotSize()) {
+		return 0;
+	}
+	SnapshotStream s(SnapshotStream::MODE_SAVE, dst + SNAPSHOT_HEADER_SIZE, size - SNAPSHOT_HEADER_SIZE);
+	snapshotTransfer(s);
+	SnapshotHeader h;
+	h.tag     = TAG_FBSN;
+	h.version = SNAPSHOT_VERSION;
+	h.level   = _currentLevel;
+	h.flags   = 0;
+	if (_res._icn) {
+		h.flags |= SF_GLOBAL_DATA;
+	}
+	if (_res._ani) {
+		h.flags |= SF_LEVEL_DATA;
+	}
+	h.cutName = _cut._cutName;
+	h.pad     = 0;
+	h.size    = SNAPSHOT_HEADER_SIZE + s.pos;
+	SnapshotStream hs(SnapshotStream::MODE_SAVE, dst, SNAPSHOT_HEADER_SIZE);
+	h.transfer(hs);
+	return h.size;
+}
+
+int Game::loadSnapshot(const uint8_t *src, size_t size) {
+	uint8_t *buf = const_cast<uint8_t *>(src);
+	if (size < SNAPSHOT_HEADER_SIZE) {
+		return SNAPSHOT_UNKNOWN;
+	}
+	SnapshotHeader h;
+	SnapshotStream hs(SnapshotStream::MODE_LOAD, buf, SNAPSHOT_HEADER_SIZE);
+	h.transfer(hs);
+	if (h.tag != TAG_FBSN) {
+		return SNAPSHOT_UNKNOWN;
+	}
+	if (h.version != SNAPSHOT_VERSION || h.size < SNAPSHOT_HEADER_SIZE || h.size > getSnapshotSize() || size < h.size ||
+		((h.flags & SF_LEVEL_DATA) && h.level >= 7) || /* ARRAY_SIZE(_gameLevels) */
+		(h.cutName != 0xFFFF && (h.cutName & 0xFF) >= Cutscene::NUM_NAMES)) {
+		log_cb(RETRO_LOG_WARN, "[RE]: Unusable snapshot, version %d, %u bytes\n", h.version, h.size);
+		return SNAPSHOT_CORRUPT;
+	}
+	/* nothing is changed unless the whole snapshot reads back */
+	const bool newCut = (h.cutName != 0xFFFF && h.cutName != _cut._cutName);
+	SnapshotStream check(SnapshotStream::MODE_CHECK, buf + SNAPSHOT_HEADER_SIZE, h.size - SNAPSHOT_HEADER_SIZE);
+	check.cutData = !newCut;
+	snapshotTransfer(check);
+	if (check.err || check.pos != check.size) {
+		log_cb(RETRO_LOG_WARN, "[RE]: Corrupt snapshot\n");
+		return SNAPSHOT_CORRUPT;
+	}
+	/* the offsets into another cutscene are checked once it is loaded, the
+	 * previous one is loaded back if they do not fit */
+	if (newCut) {
+		const uint16_t prevCutName = _cut._cutName;
+		const uint8_t *prevPol = _res._pol;
+		const uint8_t *prevCmd = _res._cmd;
+		const ptrdiff_t polOff = _cut._polPtr ? _cut._polPtr - prevPol : -1;
+		const ptrdiff_t cmdOff = _cut._cmdPtr ? _cut._cmdPtr - prevCmd : -1;
+		const ptrdiff_t cmdBakOff = _cut._cmdPtrBak ? _cut._cmdPtrBak - prevCmd : -1;
+		_cut.load(h.cutName);
+		SnapshotStream cutCheck(SnapshotStream::MODE_CHECK, buf + SNAPSHOT_HEADER_SIZE, h.size - SNAPSHOT_HEADER_SIZE);
+		snapshotTransfer(cutCheck);
+		if (cutCheck.err) {
+			log_cb(RETRO_LOG_WARN, "[RE]: Corrupt snapshot\n");
+			if (prevCutName != 0xFFFF) {
+				_cut.load(prevCutName);
+			} else {
+				_cut._cutName = prevCutName;
+			}
+			_cut._polPtr = (polOff < 0 || !_res._pol) ? 0 : _res._pol + polOff;
+			_cut._cmdPtr = (cmdOff < 0 || !_res._cmd) ? 0 : _res._cmd + cmdOff;
+			_cut._cmdPtrBak = (cmdBakOff < 0 || !_res._cmd) ? 0 : _res._cmd + cmdBakOff;
+			return SNAPSHOT_CORRUPT;
+		}
+	}
+	/* bring in the resources the state refers to, within the same level and
+	 * cutscene this is a plain copy */
+	if ((h.flags & SF_GLOBAL_DATA) && !_res._icn) {
+		loadGlobalData();
+	}
+	if ((h.flags & SF_LEVEL_DATA) && (!_res._ani || h.level != _currentLevel)) {
+		_currentLevel = h.level;
+		loadLevelData();
+	}
+	_currentLevel = h.level;
+	const uint16_t prevMonsterNum = _curMonsterNum;
+	SnapshotStream s(SnapshotStream::MODE_LOAD, buf + SNAPSHOT_HEADER_SIZE, h.size - SNAPSHOT_HEADER_SIZE);
+	snapshotTransfer(s);
+	if (_curMonsterNum != prevMonsterNum && _curMonsterNum != 0xFFFF) {
+		const char *name = _monsterNames[0][_curMonsterNum];
+		_res.load(name, Resource::OT_SPRM);
+		_res.load_SPR_OFF(name, _res._sprm);
+	}
+	_vid.refreshPresent();
+	_stateHash.reset();
+	replayStateLoaded();
+	return SNAPSHOT_OK;
+}
+
+bool Game::setRewindBudget(uint32_t bytes) {
+	if (bytes == 0) {
+		_rewind.free();
+		return true;
+	}
+	if (_rewind.isEnabled() && _rewind._ringSize == bytes) {
+		return true;
+	}
+	if (!_rewind.init(getSnapshotSize(), bytes)) {
+		log_cb(RETRO_LOG_WARN, "[RE]: Unable to allocate %u bytes of rewind buffer\n", bytes);
+		return false;
+	}
+	return true;
+}
+
+void Game::rewindPush() {
+	if (!_rewind.isEnabled()) {
+		return;
+	}
+	const size_t len = saveSnapshot(_rewind.beginPush(), _rewind._stateSize);
+	if (len == 0) {
+		/* the history cannot continue past a missed frame */
+		_rewind.reset();
+		return;
+	}
+	_rewind.commitPush(len);
+}
+
+bool Game::rewindStep() {
+	const uint8_t *state = _rewind.pop();
+	return state && loadSnapshot(state, _rewind._stateSize) == SNAPSHOT_OK;
+}
@@ -0,0 +1,179 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "game.h"
+#include "state_hash.h"
+
+StateHash::StateHash()
+	: _hash(0), _valid(false), _dirtyChunks(0), _dirty(DIRTY_ALL), _pgeNum(0), _colSlots(0) {
+}
+
+static uint32_t hashChunk(uint32_t num, const uint8_t *p) {
+	/* FNV-1a, seeded with the chunk number */
+	uint32_t h = 2166136261u ^ (num * 0x9E3779B9);
+	for (int i = 0; i < StateHash::CHUNK_SIZE; ++i) {
+		h = (h ^ p[i]) * 16777619;
+	}
+	return h;
+}
+
+void StateHash::begin() {
+	_dirtyChunks = 0;
+	if (!_valid) {
+		_hash = 0;
+		memset(_chunkHash, 0, sizeof(_chunkHash));
+		_dirty = DIRTY_ALL;
+	}
+}
+
+void StateHash::update(uint32_t pos, const void *data, uint32_t len) {
+	assert((pos % CHUNK_SIZE) == 0 && (len % CHUNK_SIZE) == 0 && pos + len <= IMAGE_SIZE);
+	const uint8_t *src = (const uint8_t *)data;
+	for (uint32_t i = 0; i < len; i += CHUNK_SIZE) {
+		uint8_t *dst = _shadow + pos + i;
+		if (_valid && memcmp(dst, src + i, CHUNK_SIZE) == 0) {
+			continue;
+		}
+		memcpy(dst, src + i, CHUNK_SIZE);
+		const uint32_t num = (pos + i) / CHUNK_SIZE;
+		const uint32_t h = hashChunk(num, dst);
+		_hash += h - _chunkHash[num];
+		_chunkHash[num] = h;
+		++_dirtyChunks;
+	}
+}
+
+uint32_t StateHash::end() {
+	_valid = true;
+	_dirty = 0;
+	return _hash;
+}
+
+static void put16(uint8_t *p, uint16_t n) {
+	p[0] = n & 255;
+	p[1] = n >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t n) {
+	put16(p, n & 0xFFFF);
+	put16(p + 2, n >> 16);
+}
+
+static uint32_t roundChunk(uint32_t len) {
+	return (len + StateHash::CHUNK_SIZE - 1) & ~(StateHash::CHUNK_SIZE - 1);
+}
+
+template <typename T>
+static uint16_t indexOf(const T *p, const T *base) {
+	return p ? p - base + 1 : 0;
+}
+
+/* The state is flattened to a portable image, little-endian fields with
+ * pointers as 1-based indices or offsets and the unused entries cleared, so
+ * that two instances with the same game state get the same hash whatever
+ * the platform. The header, the PGEs and the collision slots, which change
+ * every frame, are rebuilt on every call but only up to the entries in use.
+ * The groups, the CT data and the grid collision slots are only rebuilt when
+ * the code writing them marked them dirty; loads reset the hash. */
+uint32_t Game::getStateHash() {
+	uint8_t buf[256 * 24];
+	uint32_t pos = 0;
+	_stateHash.begin();
+
+	memset(buf, 0, 64);
+	put32(buf, _randSeed);
+	put32(buf + 4, _score);
+	buf[8] = _currentLevel;
+	buf[9] = _currentRoom;
+	put16(buf + 10, _res._pgeNum);
+	const int colSlots2 = _col_slots2Cur ? _col_slots2Cur - _col_slots2 : 0;
+	const int colSlots = _col_curSlot ? _col_curSlot - _col_slots : 0;
+	put16(buf + 12, colSlots2);
+	put16(buf + 14, colSlots);
+	put16(buf + 16, indexOf(_pge_nextFreeGroup, _pge_groups));
+	buf[18] = _taskTop;
+	for (int i = 0; i <= _taskTop && i < 12; ++i) {
+		buf[20 + i * 2]     = _task[i].tag;
+		buf[20 + i * 2 + 1] = _task[i].phase;
+	}
+	_stateHash.update(pos, buf, 64);
+	pos += 64;
+
+	const int pgeNum = _stateHash._valid ? MAX(_res._pgeNum, _stateHash._pgeNum) : 256;
+	memset(buf, 0, roundChunk(pgeNum * 24));
+	for (int i = 0; i < _res._pgeNum; ++i) {
+		const LivePGE *pge = &_pgeLive[i];
+		uint8_t *p = buf + i * 24;
+		put16(p, pge->obj_type);
+		put16(p + 2, pge->pos_x);
+		put16(p + 4, pge->pos_y);
+		p[6] = pge->anim_seq;
+		p[7] = pge->room_location;
+		put16(p + 8, pge->life);
+		put16(p + 10, pge->counter_value);
+		p[12] = pge->collision_slot;
+		p[13] = pge->next_inventory_PGE;
+		p[14] = pge->current_inventory_PGE;
+		p[15] = pge->unkF;
+		put16(p + 16, pge->anim_number);
+		p[18] = pge->flags;
+		p[19] = pge->index;
+		put16(p + 20, pge->first_obj_number);
+		put16(p + 22, indexOf(pge->next_PGE_in_room, _pgeLive));
+	}
+	_stateHash.update(pos, buf, roundChunk(pgeNum * 24));
+	_stateHash._pgeNum = _res._pgeNum;
+	pos += 256 * 24;
+
+	if (_stateHash._dirty & StateHash::DIRTY_GROUPS) {
+		for (int i = 0; i < 256; ++i) {
+			const GroupPGE *le = &_pge_groups[i];
+			memset(buf + i * 8, 0, 8);
+			put16(buf + i * 8, indexOf(le->next_entry, _pge_groups));
+			put16(buf + i * 8 + 2, le->index);
+			put16(buf + i * 8 + 4, le->group_id);
+		}
+		_stateHash.update(pos, buf, 256 * 8);
+		for (int i = 0; i < 256; ++i) {
+			put16(buf + i * 2, indexOf(_pge_groupsTable[i], _pge_groups));
+		}
+		_stateHash.update(pos + 256 * 8, buf, 256 * 2);
+	}
+	pos += 256 * 8 + 256 * 2;
+
+	if (_stateHash._dirty & StateHash::DIRTY_CT) {
+		_stateHash.update(pos, _res._ctData, sizeof(_res._ctData));
+	}
+	pos += sizeof(_res._ctData);
+
+	if (_stateHash._dirty & StateHash::DIRTY_COLSLOTS2) {
+		memset(buf, 0, 256 * 24);
+		for (int i = 0; i < colSlots2; ++i) {
+			const CollisionSlot2 *cs2 = &_col_slots2[i];
+			put16(buf + i * 24, indexOf(cs2->next_slot, _col_slots2));
+			put16(buf + i * 24 + 2, cs2->unk2 ? cs2->unk2 - _res._ctData : 0xFFFF);
+			buf[i * 24 + 4] = cs2->data_size;
+			memcpy(buf + i * 24 + 5, cs2->data_buf, sizeof(cs2->data_buf));
+		}
+		_stateHash.update(pos, buf, 256 * 24);
+	}
+	pos += 256 * 24;
+
+	const int slotsNum = _stateHash._valid ? MAX(colSlots, (int)_stateHash._colSlots) : 256;
+	memset(buf, 0, roundChunk(slotsNum * 8));
+	for (int i = 0; i < colSlots; ++i) {
+		const CollisionSlot *cs = &_col_slots[i];
+		put16(buf + i * 8, cs->ct_pos);
+		put16(buf + i * 8 + 2, indexOf(cs->prev_slot, _col_slots));
+		put16(buf + i * 8 + 4, indexOf(cs->live_pge, _pgeLive));
+		put16(buf + i * 8 + 6, cs->index);
+	}
+	_stateHash.update(pos, buf, roundChunk(slotsNum * 8));
+	_stateHash._colSlots = colSlots;
+	pos += 256 * 8;
+
+	assert(pos == StateHash::IMAGE_SIZE);
+	return _stateHash.end();
+}
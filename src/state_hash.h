@@ -0,0 +1,53 @@
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef STATE_HASH_H__
+#define STATE_HASH_H__
+
+#include "intern.h"
+
+/* Incremental hash of a fixed-size image split in 64-byte chunks. A copy of
+ * the image last hashed is kept, update() compares each chunk with it and
+ * only rehashes the ones that differ. The hash is the sum of the chunk
+ * hashes, each seeded with its chunk number, so a changed chunk is swapped
+ * in without going over the others. Sections that are rarely written are
+ * only handed over again once the game marks them dirty. */
+struct StateHash {
+	enum {
+		CHUNK_SIZE = 64,
+		/* header, PGEs, groups, groups table, CT, collision slots 2 and 1 */
+		IMAGE_SIZE = 64 + 256 * 24 + 256 * 8 + 256 * 2 + 0x1D00 + 256 * 24 + 256 * 8,
+		NUM_CHUNKS = IMAGE_SIZE / CHUNK_SIZE
+	};
+	enum {
+		DIRTY_GROUPS    = 1 << 0,
+		DIRTY_CT        = 1 << 1,
+		DIRTY_COLSLOTS2 = 1 << 2,
+		DIRTY_ALL       = DIRTY_GROUPS | DIRTY_CT | DIRTY_COLSLOTS2
+	};
+
+	uint8_t  _shadow[IMAGE_SIZE];
+	uint32_t _chunkHash[NUM_CHUNKS];
+	uint32_t _hash;
+	bool     _valid;
+	/* chunks rehashed by the last updates, for profiling */
+	uint32_t _dirtyChunks;
+	/* sections written since the last hash */
+	uint8_t  _dirty;
+	/* entries used at the last hash, the image is cleared up to them */
+	uint16_t _pgeNum, _colSlots;
+
+	StateHash();
+
+	/* the whole image is rebuilt by the next hash, after loads */
+	void reset() { _valid = false; }
+	void markDirty(uint8_t mask) { _dirty |= mask; }
+	void begin();
+	/* pos and len are multiples of CHUNK_SIZE */
+	void update(uint32_t pos, const void *data, uint32_t len);
+	uint32_t end();
+};
+
+#endif // STATE_HASH_H__
@@ -356,10 +356,14 @@ const uint8_t Cutscene::_creditsDataDOS[] = {
 	0x20, 0x20, 0x20, 0x20, 0x20, 0x7C, 0xFE, 0x50, 0xFE, 0xFF, 0x00, 0xFF
 };
 
+const int Cutscene::_creditsDataDOSSize = ARRAY_SIZE(_creditsDataDOS);
+
 const uint16_t Cutscene::_creditsCutSeq[] =  {
 	0x00, 0x05, 0x2F, 0x32, 0x36, 0x3E, 0x30, 0x39, 0x3F, 0x14, 0x34, 0xFFFF
 };
 
+const int Cutscene::_creditsCutSeqCount = ARRAY_SIZE(_creditsCutSeq);
+
 const uint8_t Cutscene::_musicTable[] = {
 	0x10, 0x15, 0x15, 0xFF, 0x15, 0x19, 0x0F, 0xFF, 0x15, 0x04, 0x15, 0xFF, 0xFF, 0x00, 0x19, 0x15,
 	0x15, 0x0D, 0x15, 0x0D, 0x18, 0x13, 0xFF, 0xFF, 0xFF, 0x14, 0x14, 0x14, 0x14, 0x14, 0xFF, 0xFF,
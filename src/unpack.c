@@ -1,48 +1,52 @@
-
 /*
  * REminiscence - Flashback interpreter
  * Copyright (C) 2005-2015 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
 #include <stdint.h>
+#include <string.h>
 #include "intern_structs.h"
 #include "unpack.h"
 
+/* The packed stream is a sequence of big-endian 32-bit words read from the
+ * end of the buffer backwards, each one consumed from its least significant
+ * bit. The words are bit-reversed into a 64-bit reservoir as they are
+ * needed, so that a field of n bits, first bit most significant, is the top
+ * n bits of the reservoir. A word is only loaded once a bit of it is needed,
+ * so the words going through the CRC are the same as when reading a bit at
+ * a time. */
 struct UnpackCtx {
 	int size, datasize;
 	uint32_t crc;
-	uint32_t bits;
+	uint64_t bits;  /* next bit in bit 63 */
+	int count;      /* bits left in the reservoir */
 	uint8_t *dst;
 	const uint8_t *src;
 };
 
-static int shiftBit(struct UnpackCtx *uc, int CF) {
-	int rCF = (uc->bits & 1);
-	uc->bits >>= 1;
-	if (CF) {
-		uc->bits |= 0x80000000;
-	}
-	return rCF;
+static INLINE uint32_t reverseBits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+	x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+	x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+	return (x >> 16) | (x << 16);
 }
 
-static int nextBit(struct UnpackCtx *uc) {
-	int CF = shiftBit(uc, 0);
-	if (uc->bits == 0) {
-		uc->bits = READ_BE_UINT32(uc->src); uc->src -= 4;
-		uc->crc ^= uc->bits;
-		CF = shiftBit(uc, 1);
-	}
-	return CF;
+static INLINE void refill(struct UnpackCtx *uc) {
+	const uint32_t w = READ_BE_UINT32(uc->src); uc->src -= 4;
+	uc->crc ^= w;
+	uc->bits |= (uint64_t)reverseBits(w) << (32 - uc->count);
+	uc->count += 32;
 }
 
-static uint16_t getBits(struct UnpackCtx *uc, uint8_t num_bits) {
-	uint16_t c = 0;
-	while (num_bits--) {
-		c <<= 1;
-		if (nextBit(uc)) {
-			c |= 1;
-		}
+/* num_bits is 1 to 16 */
+static INLINE uint16_t getBits(struct UnpackCtx *uc, int num_bits) {
+	if (uc->count < num_bits) {
+		refill(uc);
 	}
+	const uint16_t c = (uint16_t)(uc->bits >> (64 - num_bits));
+	uc->bits <<= num_bits;
+	uc->count -= num_bits;
 	return c;
 }
 
@@ -59,6 +63,14 @@ static void unpackHelper2(struct UnpackCtx *uc, uint8_t num_bits) {
 	uint16_t i = getBits(uc, num_bits);
 	uint16_t count = uc->size + 1;
 	uc->datasize -= count;
+	if (i >= count) {
+		/* the bytes copied are all written before, one move */
+		uint8_t *p = uc->dst - count + 1;
+		memcpy(p, p + i, count);
+		uc->dst -= count;
+		return;
+	}
+	/* overlapping, the copy repeats the last i bytes written */
 	while (count--) {
 		*uc->dst = *(uc->dst + i);
 		--uc->dst;
@@ -72,12 +84,21 @@ bool delphine_unpack(uint8_t *dst, const uint8_t *src, int len) {
 	uc.dst = dst + uc.datasize - 1;
 	uc.size = 0;
 	uc.crc = READ_BE_UINT32(uc.src); uc.src -= 4;
-	uc.bits = READ_BE_UINT32(uc.src); uc.src -= 4;
-	uc.crc ^= uc.bits;
+	/* the first word is only read up to its highest set bit */
+	const uint32_t first = READ_BE_UINT32(uc.src); uc.src -= 4;
+	uc.crc ^= first;
+	uc.bits = 0;
+	uc.count = 0;
+	for (uint32_t w = first; w > 1; w >>= 1) {
+		++uc.count;
+	}
+	if (uc.count != 0) {
+		uc.bits = (uint64_t)(reverseBits(first) & ~(0xFFFFFFFFu >> uc.count)) << 32;
+	}
 	do {
-		if (!nextBit(&uc)) {
+		if (!getBits(&uc, 1)) {
 			uc.size = 1;
-			if (!nextBit(&uc)) {
+			if (!getBits(&uc, 1)) {
 				unpackHelper1(&uc, 3, 0);
 			} else {
 				unpackHelper2(&uc, 8);
@@ -6,16 +6,35 @@
 
 #include "resource.h"
 #include "game.h"
+#include "palconv.h"
 #include "unpack.h"
 #include "video.h"
 
 Video::Video(Resource *res, Game *game)
 	: _res(res), _game(game) {
-	_frameBuffer          = (uint32_t *) calloc(1, Video::GAMESCREEN_W * Video::GAMESCREEN_H * sizeof(uint32_t));
+	memset(_rgbPalette, 0, sizeof(_rgbPalette));
+	memset(_rgb565Palette, 0, sizeof(_rgb565Palette));
+	_pixelFormat          = PF_XRGB8888;
+	_frameBuffer          = calloc(1, Video::GAMESCREEN_W * Video::GAMESCREEN_H * sizeof(uint32_t));
 	_frontLayer           = (uint8_t *) calloc(1, Video::GAMESCREEN_SIZE);
 	_backLayer            = (uint8_t *) calloc(1, Video::GAMESCREEN_SIZE);
+	_backLevel            = -1;
+	_backRoom             = -1;
 	_tempLayer            = (uint8_t *) calloc(1, Video::GAMESCREEN_SIZE);
 	_tempLayer2           = (uint8_t *) calloc(1, Video::GAMESCREEN_SIZE);
+	_frameDirty           = true;
+	_paletteGen           = 0;
+	_palPlanesGen         = _paletteGen - 1;
+	_indexedOutput        = false;
+	_indexedFrame         = 0;
+	_indexedSurface       = _frontLayer;
+	_skipPresent          = false;
+	_lastPresent.pending  = false;
+	_lastPresent.frontLayer = true;
+	_lastPresent.buf      = 0;
+	_convValid            = false;
+	_dirtySpans.fill();
+	_drawnSpans.fill();
 	_shakeOffset          = 0;
 	_charFrontColor       = 0;
 	_charTransparentColor = 0;
@@ -28,6 +47,7 @@ Video::~Video() {
 	free(_backLayer);
 	free(_tempLayer);
 	free(_tempLayer2);
+	free(_indexedFrame);
 }
 
 void Video::updateScreen()
@@ -132,11 +152,11 @@ void Video::setPalette0xF()
    }
 }
 
-void Video::PC_decodeLev(int level, int room) {
+void Video::PC_decodeLev(int level, int room, uint8_t *dst, uint8_t *palSlots) {
 	uint8_t *tmp = _res->_mbk;
 	_res->_mbk = _res->_bnq;
 	_res->clearBankData();
-	AMIGA_decodeLev(level, room);
+	AMIGA_decodeLev(level, room, dst, palSlots);
 	_res->_mbk = tmp;
 	_res->clearBankData();
 }
@@ -158,7 +178,9 @@ static void PC_decodeMapPlane(int sz, const uint8_t *src, uint8_t *dst) {
 	}
 }
 
-void Video::PC_decodeMap(int level, int room) {
+/* Reads _map only, the planes are unpacked to a buffer of their own so that
+ * a room can be decoded ahead at any time. */
+void Video::PC_decodeMap(int level, int room, uint8_t *dst, uint8_t *palSlots) {
 	int32_t off = READ_LE_UINT32(_res->_map + room * 6);
 	if (off == 0) {
 		log_cb(RETRO_LOG_ERROR, "Invalid room %d\n", room);
@@ -170,33 +192,101 @@ void Video::PC_decodeMap(int level, int room) {
 		packed = false;
 	}
 	const uint8_t *p = _res->_map + off;
-	_mapPalSlot1 = *p++;
-	_mapPalSlot2 = *p++;
-	_mapPalSlot3 = *p++;
-	_mapPalSlot4 = *p++;
+	palSlots[0] = *p++;
+	palSlots[1] = *p++;
+	palSlots[2] = *p++;
+	palSlots[3] = *p++;
 	if (level == 4 && room == 60) {
 		// workaround for wrong palette colors (fire)
-		_mapPalSlot4 = 5;
+		palSlots[3] = 5;
 	}
 	static const int kPlaneSize = 256 * 224 / 4;
 	if (packed) {
+		/* a run can go past the end of the plane */
+		uint8_t plane[kPlaneSize + 256];
 		for (int i = 0; i < 4; ++i) {
 			const int sz = READ_LE_UINT16(p);
 			p += 2;
-			PC_decodeMapPlane(sz, p, _res->_scratchBuffer);
+			PC_decodeMapPlane(sz, p, plane);
 			p += sz;
-			memcpy(_frontLayer + i * kPlaneSize, _res->_scratchBuffer, kPlaneSize);
+			memcpy(dst + i * kPlaneSize, plane, kPlaneSize);
 		}
 	} else {
 		for (int i = 0; i < 4; ++i) {
 			for (int y = 0; y < 224; ++y) {
 				for (int x = 0; x < 64; ++x) {
-					_frontLayer[i + x * 4 + 256 * y] = p[kPlaneSize * i + x + 64 * y];
+					dst[i + x * 4 + 256 * y] = p[kPlaneSize * i + x + 64 * y];
 				}
 			}
 		}
 	}
+}
+
+/* Copies the room background to dst, decoding it if it is not cached. */
+void Video::PC_copyRoom(int level, int room, uint8_t *dst, uint8_t *palSlots) {
+	RoomCache::Entry *e = _roomCache.find(level, room);
+	if (!e) {
+		e = _roomCache.insert(level, room);
+		uint8_t *bitmap = e ? e->bitmap : dst;
+		uint8_t *slots = e ? e->palSlots : palSlots;
+		if (_res->_map) {
+			PC_decodeMap(level, room, bitmap, slots);
+		} else {
+			PC_decodeLev(level, room, bitmap, slots);
+		}
+	}
+	if (e) {
+		memcpy(dst, e->bitmap, Video::GAMESCREEN_SIZE);
+		memcpy(palSlots, e->palSlots, 4);
+	}
+}
+
+void Video::PC_loadRoom(int level, int room) {
+	if (!_res->_map && !_res->_lev) {
+		return;
+	}
+	uint8_t palSlots[4];
+	PC_copyRoom(level, room, _frontLayer, palSlots);
 	memcpy(_backLayer, _frontLayer, Video::GAMESCREEN_SIZE);
+	_backLevel = level;
+	_backRoom = room;
+	invalidateFrontLayer();
+	_mapPalSlot1 = palSlots[0];
+	_mapPalSlot2 = palSlots[1];
+	_mapPalSlot3 = palSlots[2];
+	_mapPalSlot4 = palSlots[3];
+}
+
+/* Sets the back layer to the room, leaving the front layer and the palettes
+ * alone. The back layer is cleared if the level has no room data. */
+void Video::PC_loadBackLayer(int level, int room) {
+	if (level == _backLevel && room == _backRoom) {
+		return;
+	}
+	if (level < 0 || (!_res->_map && !_res->_lev)) {
+		memset(_backLayer, 0, Video::GAMESCREEN_SIZE);
+		_backLevel = -1;
+		_backRoom = -1;
+		return;
+	}
+	uint8_t palSlots[4];
+	PC_copyRoom(level, room, _backLayer, palSlots);
+	_backLevel = level;
+	_backRoom = room;
+}
+
+/* Only .MAP rooms are decoded ahead: the .LEV tiles are unpacked through
+ * the bank buffer, which would drop the sprite banks of the current room. */
+bool Video::PC_prefetchRoom(int level) {
+	int room;
+	if (!_res->_map || !_roomCache.nextPending(level, &room)) {
+		return false;
+	}
+	RoomCache::Entry *e = _roomCache.insert(level, room);
+	if (e) {
+		PC_decodeMap(level, room, e->bitmap, e->palSlots);
+	}
+	return true;
 }
 
 void Video::PC_setLevelPalettes() {
@@ -417,7 +507,7 @@ decodeLevHelper(uint8_t *dst, const uint8_t *src, int offset10, int offset12, co
    }
 }
 
-void Video::AMIGA_decodeLev(int level, int room)
+void Video::AMIGA_decodeLev(int level, int room, uint8_t *dst, uint8_t *palSlots)
 {
    uint8_t   *tmp   = _res->_scratchBuffer;
    const int offset = READ_BE_UINT32(_res->_lev + room * 4);
@@ -466,23 +556,23 @@ void Video::AMIGA_decodeLev(int level, int room)
          }
       }
    }
-   memset(_frontLayer, 0, Video::GAMESCREEN_SIZE);
+   memset(dst, 0, Video::GAMESCREEN_SIZE);
    if (tmp[1] != 0)
    {
-      decodeSgd(_frontLayer, tmp + offset10, _res->_sgd);
+      decodeSgd(dst, tmp + offset10, _res->_sgd);
       offset10 = 0;
    }
-   decodeLevHelper(_frontLayer, tmp, offset10, offset12, buf, tmp[1] != 0);
+   decodeLevHelper(dst, tmp, offset10, offset12, buf, tmp[1] != 0);
    free(buf);
-   memcpy(_backLayer, _frontLayer, Video::GAMESCREEN_SIZE);
-   _mapPalSlot1 = READ_BE_UINT16(tmp + 2);
-   _mapPalSlot2 = READ_BE_UINT16(tmp + 4);
-   _mapPalSlot3 = READ_BE_UINT16(tmp + 6);
-   _mapPalSlot4 = READ_BE_UINT16(tmp + 8);
+   palSlots[0] = READ_BE_UINT16(tmp + 2);
+   palSlots[1] = READ_BE_UINT16(tmp + 4);
+   palSlots[2] = READ_BE_UINT16(tmp + 6);
+   palSlots[3] = READ_BE_UINT16(tmp + 8);
 }
 
 void Video::drawSpriteSub1(const uint8_t *src, uint8_t *dst, int pitch, int h, int w, uint8_t colMask)
 {
+   markDirty(dst, w, h);
    while (h--)
    {
       for (int i = 0; i < w; ++i)
@@ -497,6 +587,7 @@ void Video::drawSpriteSub1(const uint8_t *src, uint8_t *dst, int pitch, int h, i
 
 void Video::drawSpriteSub2(const uint8_t *src, uint8_t *dst, int pitch, int h, int w, uint8_t colMask)
 {
+   markDirty(dst, w, h);
    while (h--)
    {
       for (int i = 0; i < w; ++i)
@@ -511,6 +602,7 @@ void Video::drawSpriteSub2(const uint8_t *src, uint8_t *dst, int pitch, int h, i
 
 void Video::drawSpriteSub3(const uint8_t *src, uint8_t *dst, int pitch, int h, int w, uint8_t colMask)
 {
+   markDirty(dst, w, h);
    while (h--)
    {
       for (int i = 0; i < w; ++i)
@@ -525,6 +617,7 @@ void Video::drawSpriteSub3(const uint8_t *src, uint8_t *dst, int pitch, int h, i
 
 void Video::drawSpriteSub4(const uint8_t *src, uint8_t *dst, int pitch, int h, int w, uint8_t colMask)
 {
+   markDirty(dst, w, h);
    while (h--)
    {
       for (int i = 0; i < w; ++i)
@@ -539,6 +632,7 @@ void Video::drawSpriteSub4(const uint8_t *src, uint8_t *dst, int pitch, int h, i
 
 void Video::drawSpriteSub5(const uint8_t *src, uint8_t *dst, int pitch, int h, int w, uint8_t colMask)
 {
+   markDirty(dst, w, h);
    while (h--)
    {
       for (int i = 0; i < w; ++i)
@@ -553,6 +647,7 @@ void Video::drawSpriteSub5(const uint8_t *src, uint8_t *dst, int pitch, int h, i
 
 void Video::drawSpriteSub6(const uint8_t *src, uint8_t *dst, int pitch, int h, int w, uint8_t colMask)
 {
+   markDirty(dst, w, h);
    while (h--)
    {
       for (int i = 0; i < w; ++i)
@@ -571,6 +666,7 @@ void Video::PC_drawChar(uint8_t c, int16_t y, int16_t x, bool forceDefaultFont)
 	x *= 8;
 	const uint8_t *src = fnt + (c - 32) * 32;
 	uint8_t       *dst = _frontLayer + x + 256 * y;
+	markDirty(dst, CHAR_W, CHAR_H);
 	for (int      h    = 0; h < 8; ++h)
    {
       for (int i = 0; i < 4; ++i, ++src)
@@ -638,6 +734,7 @@ const char *Video::drawString(const char *str, int16_t x, int16_t y, uint8_t col
       dst += CHAR_W;
       ++len;
    }
+	markDirty(_frontLayer + y * 256 + x, len * CHAR_W, CHAR_H);
 	return str - 1;
 }
 
@@ -669,12 +766,26 @@ void Video::setPalette(const uint8_t *pal, int n)
       uint8_t r = pal[i * 3 + 0];
       uint8_t g = pal[i * 3 + 1];
       uint8_t b = pal[i * 3 + 2];
-      _rgbPalette[i] = r << 16u | g << 8u | b << 0u;
+      const uint32_t color = r << 16u | g << 8u | b << 0u;
+      if (_rgbPalette[i] != color)
+      {
+         _rgbPalette[i]    = color;
+         _rgb565Palette[i] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+         _convValid        = false;
+         ++_paletteGen;
+      }
    }
 }
 
 void Video::setPaletteEntry(int i, const Color *c) {
-	_rgbPalette[i] = c->r << 16u | c->g << 8u | c->b << 0u;
+	const uint32_t color = c->r << 16u | c->g << 8u | c->b << 0u;
+	if (_rgbPalette[i] != color) {
+		/* every pixel using this entry is stale, reconvert the whole layer */
+		_rgbPalette[i]    = color;
+		_rgb565Palette[i] = ((c->r & 0xF8) << 8) | ((c->g & 0xFC) << 3) | (c->b >> 3);
+		_convValid        = false;
+		++_paletteGen;
+	}
 }
 
 void Video::getPaletteEntry(int i, Color *c) {
@@ -683,7 +794,57 @@ void Video::getPaletteEntry(int i, Color *c) {
 	c->b = static_cast<uint8_t>(_rgbPalette[i] >> 0u);
 }
 
+void Video::setPixelFormat(PixelFormat fmt) {
+	if (fmt == _pixelFormat) {
+		return;
+	}
+	_pixelFormat = fmt;
+	free(_frameBuffer);
+	_frameBuffer = calloc(1, Video::GAMESCREEN_W * Video::GAMESCREEN_H * getBytesPerPixel());
+	_convValid   = false;
+	_frameDirty  = true;
+}
+
+bool Video::setIndexedOutput(bool enable) {
+	if (enable && !_indexedFrame) {
+		_indexedFrame = (uint8_t *) calloc(1, Video::GAMESCREEN_SIZE);
+		if (!_indexedFrame) {
+			return false;
+		}
+	}
+	_indexedOutput = enable;
+	_convValid     = false;
+	_frameDirty    = true;
+	return true;
+}
+
+/* Converts n indexed pixels to the framebuffer, starting at pixel offset */
+void Video::expandSpan(int offset, const uint8_t *src, int n) {
+	if (_palPlanesGen != _paletteGen) {
+		palSplit(&_palPlanes, _rgbPalette, _rgb565Palette);
+		_palPlanesGen = _paletteGen;
+	}
+	if (_pixelFormat == PF_RGB565) {
+		palExpand16((uint16_t *) _frameBuffer + offset, src, n, _rgb565Palette, &_palPlanes);
+	} else {
+		palExpand32((uint32_t *) _frameBuffer + offset, src, n, _rgbPalette, &_palPlanes);
+	}
+}
+
 void Video::copyRect(int x, int y, int w, int h, const uint8_t *buf, int pitch) {
+   _lastPresent.frontLayer = false;
+   _lastPresent.x          = x;
+   _lastPresent.y          = y;
+   _lastPresent.w          = w;
+   _lastPresent.h          = h;
+   _lastPresent.buf        = buf;
+   _lastPresent.pitch      = pitch;
+   if (_skipPresent)
+   {
+      _lastPresent.pending    = true;
+      _convValid              = false;
+      return;
+   }
    if (x < 0)
       x = 0;
    else if (x >= Video::GAMESCREEN_W)
@@ -697,20 +858,181 @@ void Video::copyRect(int x, int y, int w, int h, const uint8_t *buf, int pitch)
    if (y + h > Video::GAMESCREEN_H)
       h = Video::GAMESCREEN_H - y;
 
-   uint32_t *p = _frameBuffer + y * Video::GAMESCREEN_W + x;
+   int offset = y * Video::GAMESCREEN_W + x;
    buf += y * pitch + x;
 
+   if (_indexedOutput)
+   {
+      for (int j = 0; j < h; ++j)
+      {
+         memcpy(_indexedFrame + offset, buf, w);
+         offset += Video::GAMESCREEN_W;
+         buf    += pitch;
+      }
+      _indexedSurface = _indexedFrame;
+      _frameDirty     = true;
+      _convValid      = false;
+      return;
+   }
+
    for (int j = 0; j < h; ++j)
    {
-      int i;
-      for (i = 0; i < w; ++i)
-         p[i] = _rgbPalette[buf[i]];
-      p   += Video::GAMESCREEN_W;
-      buf += pitch;
+      expandSpan(offset, buf, w);
+      offset += Video::GAMESCREEN_W;
+      buf    += pitch;
    }
+   _frameDirty = true;
+   /* buf may alias _frontLayer through untracked writes (cutscene pages),
+    * the next copyFrontLayer() has to start over from a full conversion */
+   _convValid  = false;
 
 #if 0
    if (_pi.dbgMask & PlayerInput::DF_DBLOCKS)
       drawRect(x, y, w, h, 0xE7);
 #endif
 }
+
+void Video::RowSpans::clear() {
+	for (int y = 0; y < GAMESCREEN_H; ++y) {
+		x0[y] = GAMESCREEN_W;
+		x1[y] = 0;
+	}
+}
+
+void Video::RowSpans::fill() {
+	for (int y = 0; y < GAMESCREEN_H; ++y) {
+		x0[y] = 0;
+		x1[y] = GAMESCREEN_W;
+	}
+}
+
+void Video::RowSpans::add(int y, int xa, int xb) {
+	if (xa < x0[y]) {
+		x0[y] = xa;
+	}
+	if (xb > x1[y]) {
+		x1[y] = xb;
+	}
+}
+
+void Video::RowSpans::merge(const RowSpans &s) {
+	for (int y = 0; y < GAMESCREEN_H; ++y) {
+		if (s.x0[y] < s.x1[y]) {
+			add(y, s.x0[y], s.x1[y]);
+		}
+	}
+}
+
+void Video::markDirty(int x, int y, int w, int h) {
+	if (x + w > GAMESCREEN_W) {
+		/* a string running past the right edge wraps onto the next line */
+		x = 0;
+		w = GAMESCREEN_W;
+		++h;
+	}
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if (y + h > GAMESCREEN_H) {
+		h = GAMESCREEN_H - y;
+	}
+	if (w <= 0 || h <= 0) {
+		return;
+	}
+	for (int j = y; j < y + h; ++j) {
+		_dirtySpans.add(j, x, x + w);
+		_drawnSpans.add(j, x, x + w);
+	}
+}
+
+/* dst may be in another layer (or off the clipped front layer), compare the
+ * addresses as integers rather than subtracting unrelated pointers. Draws to
+ * the other layers do not change what is presented. */
+void Video::markDirty(const uint8_t *dst, int w, int h) {
+	const uintptr_t addr = (uintptr_t)dst;
+	const uintptr_t front = (uintptr_t)_frontLayer;
+	if (addr < front || addr >= front + GAMESCREEN_SIZE) {
+		return;
+	}
+	const int offset = (int)(addr - front);
+	markDirty(offset % GAMESCREEN_W, offset / GAMESCREEN_W, w, h);
+}
+
+void Video::invalidateFrontLayer() {
+	_dirtySpans.fill();
+	_drawnSpans.fill();
+}
+
+void Video::restoreBackLayer() {
+	memcpy(_frontLayer, _backLayer, GAMESCREEN_SIZE);
+	/* the sprites of the previous frame are erased, their pixels change again */
+	_dirtySpans.merge(_drawnSpans);
+	_drawnSpans.clear();
+}
+
+/* copyRect() of the whole _frontLayer, converting only the spans changed
+ * since the previous call. Only valid when every write to _frontLayer
+ * went through the tracked blitters or is followed by invalidateFrontLayer(). */
+void Video::copyFrontLayer() {
+	_lastPresent.frontLayer = true;
+	if (_skipPresent) {
+		_lastPresent.pending    = true;
+		return;
+	}
+	if (_indexedOutput) {
+		/* nothing draws to _frontLayer until the next gameplay frame */
+		_indexedSurface = _frontLayer;
+		_frameDirty     = true;
+		_convValid      = false;
+		return;
+	}
+	if (!_convValid) {
+		copyRect(0, 0, GAMESCREEN_W, GAMESCREEN_H, _frontLayer, GAMESCREEN_W);
+		_lastPresent.frontLayer = true;
+		_convValid = true;
+		_dirtySpans.clear();
+		return;
+	}
+	for (int y = 0; y < GAMESCREEN_H; ++y) {
+		const int x0 = _dirtySpans.x0[y];
+		const int x1 = _dirtySpans.x1[y];
+		if (x0 >= x1) {
+			continue;
+		}
+		const int offset = y * GAMESCREEN_W + x0;
+		expandSpan(offset, _frontLayer + offset, x1 - x0);
+		_frameDirty = true;
+	}
+	_dirtySpans.clear();
+}
+
+/* Converts the whole image again from the source of the last present, for
+ * when the layers were replaced wholesale (snapshot load). */
+void Video::refreshPresent() {
+	invalidateFrontLayer();
+	_convValid = false;
+	if (_lastPresent.frontLayer || !_lastPresent.buf) {
+		copyFrontLayer();
+	} else {
+		copyRect(0, 0, GAMESCREEN_W, GAMESCREEN_H, _lastPresent.buf, _lastPresent.pitch);
+	}
+}
+
+/* Converts the last present recorded while _skipPresent was set. The buffer
+ * is still intact: every presenter leaves it alone until its next present. */
+void Video::flushPresent() {
+	if (!_lastPresent.pending) {
+		return;
+	}
+	_lastPresent.pending = false;
+	if (_lastPresent.frontLayer) {
+		copyFrontLayer();
+	} else {
+		copyRect(_lastPresent.x, _lastPresent.y, _lastPresent.w, _lastPresent.h, _lastPresent.buf, _lastPresent.pitch);
+	}
+}
@@ -8,6 +8,8 @@
 #define VIDEO_H__
 
 #include "intern.h"
+#include "palconv.h"
+#include "room_cache.h"
 
 struct Resource;
 struct Game;
@@ -32,6 +34,7 @@ struct Video {
 
 	uint8_t *_frontLayer; // drawing layer
 	uint8_t *_backLayer;  // background layer; used to clear screen between frames
+	int8_t  _backLevel, _backRoom; // the room held by _backLayer, -1 if none
 	uint8_t *_tempLayer;
 	uint8_t *_tempLayer2;
 	uint8_t _unkPalSlot1, _unkPalSlot2;
@@ -41,8 +44,61 @@ struct Video {
 	uint8_t _charShadowColor;
 	uint8_t _shakeOffset;
 
-	uint32_t _rgbPalette[256];
-	uint32_t *_frameBuffer;
+	enum PixelFormat {
+		PF_XRGB8888,
+		PF_RGB565
+	};
+
+	/* _rgbPalette stays XRGB8888 in both modes, getPaletteEntry() and the
+	 * fades read colors back from it; _rgb565Palette mirrors it for PF_RGB565 */
+	uint32_t    _rgbPalette[256];
+	uint16_t    _rgb565Palette[256];
+	PixelFormat _pixelFormat;
+	void        *_frameBuffer; /* uint32_t or uint16_t pixels, GAMESCREEN_W pitch */
+	bool        _frameDirty; /* _frameBuffer changed since the last present */
+	uint32_t    _paletteGen; /* bumped whenever a palette entry changes value */
+	PalPlanes   _palPlanes; /* both palettes split for the lookup kernels */
+	uint32_t    _palPlanesGen; /* _paletteGen _palPlanes was split at */
+
+	/* Indexed output: presents skip the palette conversion and only record
+	 * which 8-bit image the host should expand itself. Gameplay frames hand
+	 * out _frontLayer as is, other presents are copied to _indexedFrame. */
+	bool          _indexedOutput;
+	uint8_t       *_indexedFrame;
+	const uint8_t *_indexedSurface;
+
+	/* Turbo mode (Game::runFrames): presents are only recorded, the last one
+	 * is replayed by flushPresent() once the batch is done. The source of the
+	 * last present is kept in any mode for refreshPresent(). */
+	bool          _skipPresent;
+	struct {
+		bool          pending;
+		bool          frontLayer; /* copyFrontLayer(), otherwise copyRect() */
+		int           x, y, w, h;
+		const uint8_t *buf;
+		int           pitch;
+	} _lastPresent;
+
+	/* Per-row [x0, x1) spans of _frontLayer, an empty row has x0 >= x1 */
+	struct RowSpans {
+		int16_t x0[GAMESCREEN_H];
+		int16_t x1[GAMESCREEN_H];
+
+		void clear();
+		void fill();
+		void add(int y, int xa, int xb);
+		void merge(const RowSpans &s);
+	};
+
+	/* Dirty-rectangle tracking for copyFrontLayer(). _dirtySpans covers what
+	 * changed since _frameBuffer was last converted from _frontLayer (only
+	 * meaningful while _convValid), _drawnSpans what was drawn over since
+	 * the last restoreBackLayer(). */
+	RowSpans _dirtySpans;
+	RowSpans _drawnSpans;
+	bool     _convValid;
+
+	RoomCache _roomCache;
 
 	Video(Resource *res, Game *game);
 	~Video();
@@ -56,21 +112,37 @@ struct Video {
 	StepResult fadeOutStep();
 
 	// frame buffer
+	void setPixelFormat(PixelFormat fmt);
+	bool setIndexedOutput(bool enable); /* false if out of memory, left off */
+	int getBytesPerPixel() const { return _pixelFormat == PF_RGB565 ? 2 : 4; }
+	void expandSpan(int offset, const uint8_t *src, int n);
 	void setPalette(const uint8_t *pal, int n);
 	void setPaletteEntry(int i, const Color *c);
 	void getPaletteEntry(int i, Color *c);
 	void copyRect(int x, int y, int w, int h, const uint8_t *buf, int pitch);
+	void copyFrontLayer();
+	void flushPresent();
+	void refreshPresent();
+	void restoreBackLayer();
+	void invalidateFrontLayer();
+	void markDirty(int x, int y, int w, int h);
+	void markDirty(const uint8_t *dst, int w, int h);
 
 	void setPaletteSlotBE(int palSlot, int palNum);
 	void setPaletteSlotLE(int palSlot, const uint8_t *palData);
 	void setTextPalette();
 	void setPalette0xF();
-	void PC_decodeLev(int level, int room);
-	void PC_decodeMap(int level, int room);
+	/* decode the room background to dst, the 4 palette slots to palSlots */
+	void PC_decodeLev(int level, int room, uint8_t *dst, uint8_t *palSlots);
+	void PC_decodeMap(int level, int room, uint8_t *dst, uint8_t *palSlots);
+	void PC_copyRoom(int level, int room, uint8_t *dst, uint8_t *palSlots);
+	void PC_loadRoom(int level, int room);
+	void PC_loadBackLayer(int level, int room);
+	bool PC_prefetchRoom(int level);
 	void PC_setLevelPalettes();
 	void PC_decodeIcn(const uint8_t *src, int num, uint8_t *dst);
 	void PC_decodeSpc(const uint8_t *src, int w, int h, uint8_t *dst);
-	void AMIGA_decodeLev(int level, int room);
+	void AMIGA_decodeLev(int level, int room, uint8_t *dst, uint8_t *palSlots);
 
 	void drawSpriteSub1(const uint8_t *src, uint8_t *dst, int pitch, int h, int w, uint8_t colMask);
 	void drawSpriteSub2(const uint8_t *src, uint8_t *dst, int pitch, int h, int w, uint8_t colMask);